@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "libplatsch.h"
+
+/*
+ * Dumb buffers are usually mapped write-combined. Reading from them is
+ * uncached and writes are only fast if whole lines are streamed, so copy and
+ * clear with wide non-temporal stores that bypass the cache and don't pollute
+ * it with pixels the CPU never looks at again.
+ */
+
+static void copy_row_generic(void *dst, const void *src, size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+static void clear_row_generic(void *dst, size_t len)
+{
+	memset(dst, 0, len);
+}
+
+#if defined(__x86_64__)
+/* SSE2 is part of the x86-64 baseline */
+static void copy_row_sse2(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head = -(uintptr_t)d & 15;
+
+	if (head > len)
+		head = len;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+	}
+	memcpy(d, s, len);
+	_mm_sfence();
+}
+
+static void clear_row_sse2(void *dst, size_t len)
+{
+	uint8_t *d = dst;
+	size_t head = -(uintptr_t)d & 15;
+	__m128i zero = _mm_setzero_si128();
+
+	if (head > len)
+		head = len;
+	memset(d, 0, head);
+	d += head;
+	len -= head;
+
+	for (; len >= 16; len -= 16, d += 16)
+		_mm_stream_si128((__m128i *)d, zero);
+	memset(d, 0, len);
+	_mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void copy_row_avx2(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head = -(uintptr_t)d & 31;
+
+	if (head > len)
+		head = len;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 128; len -= 128, d += 128, s += 128) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)s);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+		__m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+		_mm256_stream_si256((__m256i *)d, a);
+		_mm256_stream_si256((__m256i *)(d + 32), b);
+		_mm256_stream_si256((__m256i *)(d + 64), c);
+		_mm256_stream_si256((__m256i *)(d + 96), e);
+	}
+	memcpy(d, s, len);
+	_mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void clear_row_avx2(void *dst, size_t len)
+{
+	uint8_t *d = dst;
+	size_t head = -(uintptr_t)d & 31;
+	__m256i zero = _mm256_setzero_si256();
+
+	if (head > len)
+		head = len;
+	memset(d, 0, head);
+	d += head;
+	len -= head;
+
+	for (; len >= 32; len -= 32, d += 32)
+		_mm256_stream_si256((__m256i *)d, zero);
+	memset(d, 0, len);
+	_mm_sfence();
+}
+#endif /* __x86_64__ */
+
+#if defined(__aarch64__)
+/* NEON is mandatory on AArch64, STNP is its non-temporal store pair */
+static void copy_row_neon(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head = -(uintptr_t)d & 31;
+
+	if (head > len)
+		head = len;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		asm volatile("ldp q0, q1, [%1]\n"
+			     "ldp q2, q3, [%1, #32]\n"
+			     "stnp q0, q1, [%0]\n"
+			     "stnp q2, q3, [%0, #32]\n"
+			     : : "r" (d), "r" (s)
+			     : "v0", "v1", "v2", "v3", "memory");
+	}
+	memcpy(d, s, len);
+}
+
+static void clear_row_neon(void *dst, size_t len)
+{
+	uint8_t *d = dst;
+	size_t head = -(uintptr_t)d & 31;
+
+	if (head > len)
+		head = len;
+	memset(d, 0, head);
+	d += head;
+	len -= head;
+
+	for (; len >= 32; len -= 32, d += 32)
+		asm volatile("stnp xzr, xzr, [%0]\n"
+			     "stnp xzr, xzr, [%0, #16]\n"
+			     : : "r" (d) : "memory");
+	memset(d, 0, len);
+}
+#endif /* __aarch64__ */
+
+static void (*copy_row)(void *dst, const void *src, size_t len) = copy_row_generic;
+static void (*clear_row)(void *dst, size_t len) = clear_row_generic;
+
+__attribute__((constructor))
+static void blit_init(void)
+{
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		copy_row = copy_row_avx2;
+		clear_row = clear_row_avx2;
+	} else {
+		copy_row = copy_row_sse2;
+		clear_row = clear_row_sse2;
+	}
+#elif defined(__aarch64__)
+	copy_row = copy_row_neon;
+	clear_row = clear_row_neon;
+#endif
+}
+
+void blit_rows(void *dst, uint32_t dst_stride, const void *src,
+	       uint32_t src_stride, size_t row_len, uint32_t rows)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	/* a single pass if both sides are contiguous */
+	if (dst_stride == row_len && src_stride == row_len) {
+		copy_row(d, s, row_len * rows);
+		return;
+	}
+
+	for (; rows; rows--, d += dst_stride, s += src_stride)
+		copy_row(d, s, row_len);
+}
+
+void blit_clear(void *dst, uint32_t dst_stride, size_t row_len, uint32_t rows)
+{
+	uint8_t *d = dst;
+
+	if (dst_stride == row_len) {
+		clear_row(d, row_len * rows);
+		return;
+	}
+
+	for (; rows; rows--, d += dst_stride)
+		clear_row(d, row_len);
+}
+
+/*
+ * Map a file read-only. If sequential is set, the whole file is read ahead
+ * for a single sequential pass. An empty file results in *map being NULL.
+ */
+int map_file(const char *filename, const void **map, size_t *size,
+	     bool sequential)
+{
+	struct stat s;
+	void *m = NULL;
+	int fd, ret = 0;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		error("Failed to open %s: %m\n", filename);
+		return -ENOENT;
+	}
+
+	if (fstat(fd, &s) < 0) {
+		ret = -errno;
+		error("Failed to stat %s: %m\n", filename);
+		goto out_close;
+	}
+
+	if (s.st_size) {
+		m = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			ret = -errno;
+			error("Failed to mmap %s: %m\n", filename);
+			goto out_close;
+		}
+		if (sequential) {
+			madvise(m, s.st_size, MADV_SEQUENTIAL);
+			madvise(m, s.st_size, MADV_WILLNEED);
+		}
+	}
+
+	*map = m;
+	*size = s.st_size;
+
+out_close:
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Copy a raw image with dev's resolution into dst, which has dev's stride.
+ * format is the format of the image, either dev's format or XRGB8888, which
+ * is converted while copying. Rows are either tightly packed or padded to the
+ * stride of the dumb buffer. Only the part of dst the image doesn't cover is
+ * cleared. name is only used for messages.
+ */
+int blit_image(struct modeset_dev *dev, void *dst, const void *src, size_t size,
+	       const struct platsch_format *format, const char *name)
+{
+	size_t row_len = dev->width * dev->format->bpp / 8;
+	size_t src_row_len = dev->width * format->bpp / 8;
+	uint32_t src_stride, rows;
+	int ret = 0;
+
+	if (format == dev->format && size >= (size_t)dev->stride * dev->height)
+		src_stride = dev->stride;
+	else
+		src_stride = src_row_len;
+
+	rows = size / src_stride;
+	if (rows > dev->height)
+		rows = dev->height;
+
+	if (rows < dev->height) {
+		error("Could only read %u/%u rows from %s\n", rows, dev->height,
+		      name);
+		ret = -EIO;
+	}
+
+	if (format == dev->format) {
+		blit_rows(dst, dev->stride, src, src_stride, row_len, rows);
+	} else if (convert_rows(dst, dev->stride, dev->format->format,
+				src, src_stride, dev->width, rows, 0)) {
+		error("Cannot convert %s to %s\n", name, dev->format->name);
+		ret = -EINVAL;
+		/* nothing was copied */
+		rows = 0;
+	}
+
+	blit_clear((uint8_t *)dst + (size_t)rows * dev->stride, dev->stride,
+		   row_len, dev->height - rows);
+
+	return ret;
+}
+
+int blit_file(struct modeset_dev *dev, void *dst, const char *filename,
+	      const struct platsch_format *format)
+{
+	const void *src;
+	size_t size;
+	int ret;
+
+	ret = map_file(filename, &src, &size, true);
+	if (ret)
+		return ret;
+
+	ret = blit_image(dev, dst, src, size, format, filename);
+
+	if (src)
+		munmap((void *)src, size);
+
+	return ret;
+}
@@ -0,0 +1,265 @@
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "bundle.h"
+
+/* the bundle is opened once and shared by all connectors */
+static pthread_mutex_t bundle_lock = PTHREAD_MUTEX_INITIALIZER;
+static const void *bundle_map;
+static size_t bundle_size;
+static bool bundle_tried;
+
+/* Copy entry i of the index, converted to host byte order, into e */
+static void bundle_entry(const void *map, uint32_t i, struct bundle_entry *e)
+{
+	const struct bundle_header *hdr = map;
+	const struct bundle_entry *src = (const struct bundle_entry *)(hdr + 1) + i;
+
+	e->type = le32toh(src->type);
+	e->encoding = le32toh(src->encoding);
+	e->width = le32toh(src->width);
+	e->height = le32toh(src->height);
+	e->format = le32toh(src->format);
+	e->reserved = 0;
+	e->offset = le64toh(src->offset);
+	e->size = le64toh(src->size);
+	memcpy(e->name, src->name, sizeof(e->name));
+}
+
+static uint32_t bundle_count(const void *map)
+{
+	const struct bundle_header *hdr = map;
+
+	return le32toh(hdr->count);
+}
+
+static int bundle_validate(const void *map, size_t size, const char *path)
+{
+	const struct bundle_header *hdr = map;
+	struct bundle_entry e;
+	uint32_t count, i;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, BUNDLE_MAGIC, sizeof(hdr->magic)) ||
+	    le32toh(hdr->version) != BUNDLE_VERSION) {
+		error("%s is no bundle\n", path);
+		return -EINVAL;
+	}
+
+	count = bundle_count(map);
+	if (count > (size - sizeof(*hdr)) / sizeof(e)) {
+		error("%s is truncated\n", path);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < count; i++) {
+		bundle_entry(map, i, &e);
+		if (e.offset > size || e.size > size - e.offset) {
+			error("Entry %u of %s is out of bounds\n", i, path);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The bundle is mapped without any readahead advice, as only a few of its
+ * entries are needed. Read the one that is about to be used in one go.
+ */
+static const void *bundle_prefetch(const struct bundle_entry *e)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	const uint8_t *data = (const uint8_t *)bundle_map + e->offset;
+	uintptr_t start = (uintptr_t)data & ~(page - 1);
+
+	if (e->size) {
+		madvise((void *)start, (uintptr_t)data + e->size - start,
+			MADV_SEQUENTIAL);
+		madvise((void *)start, (uintptr_t)data + e->size - start,
+			MADV_WILLNEED);
+	}
+
+	return data;
+}
+
+/*
+ * Map <dir>/<base>.bundle, or platsch_bundle if set. Returns -ENOENT if there
+ * is none, which isn't an error.
+ */
+static int bundle_open(const char *dir, const char *base)
+{
+	char path[PATH_MAX];
+	const char *env;
+	const void *map;
+	size_t size;
+	int ret = 0;
+
+	pthread_mutex_lock(&bundle_lock);
+
+	if (bundle_tried)
+		goto out;
+	bundle_tried = true;
+
+	env = getenv("platsch_bundle");
+	if (env)
+		ret = snprintf(path, sizeof(path), "%s", env);
+	else
+		ret = snprintf(path, sizeof(path), "%s/%s.bundle", dir, base);
+	if (ret >= sizeof(path)) {
+		error("Failed to fit filename into buffer\n");
+		goto out;
+	}
+
+	if (access(path, R_OK))
+		goto out;
+
+	ret = map_file(path, &map, &size, false);
+	if (ret)
+		goto out;
+
+	if (bundle_validate(map, size, path)) {
+		if (map)
+			munmap((void *)map, size);
+		goto out;
+	}
+
+	debug("using bundle %s\n", path);
+	bundle_map = map;
+	bundle_size = size;
+
+out:
+	ret = bundle_map ? 0 : -ENOENT;
+	pthread_mutex_unlock(&bundle_lock);
+
+	return ret;
+}
+
+/*
+ * Find the splash image for dev and copy its entry into best. An image in
+ * dev's format is preferred, then an XRGB8888 one that is converted, then a
+ * QOI image.
+ */
+static int bundle_find_image(struct modeset_dev *dev, const char *dir,
+			     const char *base, struct bundle_entry *best)
+{
+	int prio, best_prio = INT_MAX;
+	struct bundle_entry e;
+	uint32_t count, i;
+
+	if (bundle_open(dir, base))
+		return -ENOENT;
+
+	count = bundle_count(bundle_map);
+	for (i = 0; i < count; i++) {
+		bundle_entry(bundle_map, i, &e);
+
+		if (e.type != BUNDLE_SPLASH || e.width != dev->width ||
+		    e.height != dev->height)
+			continue;
+
+		if (e.encoding == BUNDLE_QOI)
+			prio = 2;
+		else if (e.format == dev->format->format)
+			prio = 0;
+		else if (e.format == DRM_FORMAT_XRGB8888)
+			prio = 1;
+		else
+			continue;
+
+		if (prio < best_prio) {
+			*best = e;
+			best_prio = prio;
+		}
+	}
+
+	return best_prio < INT_MAX ? 0 : -ENOENT;
+}
+
+/*
+ * Check if the bundle has a splash image for dev and return the format it is
+ * stored in. QOI images count as XRGB8888, they are converted anyway.
+ */
+int bundle_lookup(struct modeset_dev *dev, const char *dir, const char *base,
+		  const struct platsch_format **format)
+{
+	struct bundle_entry e;
+	int ret;
+
+	ret = bundle_find_image(dev, dir, base, &e);
+	if (ret)
+		return ret;
+
+	*format = platsch_format_get(e.encoding == BUNDLE_QOI ?
+				     DRM_FORMAT_XRGB8888 : e.format);
+
+	return 0;
+}
+
+/*
+ * Draw dev's splash image from the bundle into dst, which has dev's stride.
+ * Returns -ENOENT if there is no bundle or no image for dev.
+ */
+int bundle_draw(struct modeset_dev *dev, void *dst, const char *dir,
+		const char *base)
+{
+	const struct platsch_format *format;
+	struct bundle_entry e;
+	const void *data;
+
+	if (bundle_find_image(dev, dir, base, &e))
+		return -ENOENT;
+
+	data = bundle_prefetch(&e);
+
+	switch (e.encoding) {
+	case BUNDLE_RAW:
+	case BUNDLE_RLE:
+		format = platsch_format_get(e.format);
+		if (!format)
+			return -EINVAL;
+		if (e.encoding == BUNDLE_RAW)
+			return blit_image(dev, dst, data, e.size, format, e.name);
+		return rle_image(dev, dst, data, e.size, format, e.name);
+	case BUNDLE_QOI:
+		return qoi_image(dev, dst, data, e.size, e.name);
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Look up a sprite or font by name. The returned data stays valid until the
+ * process exits.
+ */
+const void *bundle_asset(const char *dir, const char *base, const char *name,
+			 size_t *size)
+{
+	struct bundle_entry e;
+	uint32_t count, i;
+
+	if (bundle_open(dir, base))
+		return NULL;
+
+	count = bundle_count(bundle_map);
+	for (i = 0; i < count; i++) {
+		bundle_entry(bundle_map, i, &e);
+		if (e.type == BUNDLE_SPLASH ||
+		    strncmp(e.name, name, sizeof(e.name)))
+			continue;
+
+		*size = e.size;
+		return bundle_prefetch(&e);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,59 @@
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include <stdint.h>
+
+/*
+ * Splash asset bundle (<base>.bundle)
+ *
+ * A single file holding all images of a splash setup, so it can be opened
+ * and mapped once instead of looking up a file per connector and backend:
+ *
+ *   struct bundle_header
+ *   struct bundle_entry[count]
+ *   payloads, each starting at a multiple of BUNDLE_ALIGN
+ *
+ * Splash images are looked up by resolution, format and encoding; their
+ * payload is a raw, RLE (rle.h) or QOI image. Spinner sprites and fonts are
+ * looked up by name and stored as they are. Header and index fields are in
+ * little endian byte order, payloads in whatever their encoding defines.
+ */
+
+#define BUNDLE_MAGIC		"PBDL"
+#define BUNDLE_VERSION		1
+#define BUNDLE_ALIGN		4096
+#define BUNDLE_NAME_LEN		64
+
+enum bundle_type {
+	BUNDLE_SPLASH = 1,
+	BUNDLE_SPRITE,
+	BUNDLE_FONT,
+};
+
+enum bundle_encoding {
+	BUNDLE_RAW = 1,
+	BUNDLE_RLE,
+	BUNDLE_QOI,
+	BUNDLE_FILE,	/* stored as is, e.g. PNG or TTF */
+};
+
+struct bundle_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct bundle_entry {
+	uint32_t type;
+	uint32_t encoding;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;	/* DRM fourcc, 0 if not a raw or RLE image */
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;
+	char name[BUNDLE_NAME_LEN];
+};
+
+#endif /* __BUNDLE_H__ */
@@ -14,24 +14,38 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <dirent.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include <drm_fourcc.h>
 #include <cairo.h>
 
 #include "libplatsch.h"
+#include "glyphs.h"
 
-static struct cairo_ctx {
+/* connectors are drawn concurrently, so every thread has its own context */
+static __thread struct cairo_ctx {
 	struct modeset_dev *dev;
 	const char *dir;
 	const char *base;
 	char filename[128];
+	/* format of the raw image found by detect */
+	const struct platsch_format *file_format;
+	/* dev as seen by the raw loaders when drawing into an XRGB8888 shadow */
+	struct modeset_dev shadow_dev;
+	bool shadow;
+	/* the connector's dev, a raw image in its format bypasses the shadow */
+	struct modeset_dev *target;
+	bool direct;
 } ctx;
 
 struct import_backend {
@@ -84,13 +98,139 @@ static const char *image_format_to_string(cairo_format_t format)
 	}
 }
 
+/*
+ * Decoding and scaling a PNG is slow, so the result is cached as a raw image
+ * in platsch_cache_dir if that is set. The name contains the size and mtime
+ * of the PNG, so replacing it invalidates the cached image, which is removed
+ * once the new one is stored.
+ */
+static int png_cache_filename(char *filename, size_t filename_sz,
+			      const char *png)
+{
+	struct modeset_dev *dev = ctx.dev;
+	const char *cache_dir;
+	struct stat s;
+	int ret;
+
+	cache_dir = getenv("platsch_cache_dir");
+	if (!cache_dir)
+		return -ENOENT;
+
+	if (stat(png, &s))
+		return -errno;
+
+	ret = snprintf(filename, filename_sz, "%s/%s-%ux%u-%s-%llx-%llx.bin",
+		       cache_dir, ctx.base, dev->width, dev->height,
+		       dev->format->name,
+		       (unsigned long long)s.st_mtim.tv_sec * 1000000000 +
+		       s.st_mtim.tv_nsec, (unsigned long long)s.st_size);
+	if (ret >= filename_sz) {
+		error("Failed to fit filename into buffer\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Remove the images cached for earlier versions of the PNG at this size and
+ * format, keep is the name of the one just stored.
+ */
+static void png_cache_prune(const char *keep)
+{
+	struct modeset_dev *dev = ctx.dev;
+	const char *cache_dir = getenv("platsch_cache_dir");
+	unsigned long long mtime, size;
+	char prefix[128];
+	int n;
+	struct dirent *d;
+	size_t len;
+	DIR *dir;
+
+	len = snprintf(prefix, sizeof(prefix), "%s-%ux%u-%s-", ctx.base,
+		       dev->width, dev->height, dev->format->name);
+	if (len >= sizeof(prefix))
+		return;
+
+	dir = opendir(cache_dir);
+	if (!dir)
+		return;
+
+	while ((d = readdir(dir))) {
+		n = 0;
+		if (strncmp(d->d_name, prefix, len) || !strcmp(d->d_name, keep) ||
+		    sscanf(d->d_name + len, "%llx-%llx.bin%n", &mtime, &size, &n) != 2 ||
+		    !n || d->d_name[len + n])
+			continue;
+
+		if (unlinkat(dirfd(dir), d->d_name, 0))
+			error("Failed to remove %s/%s: %m\n", cache_dir, d->d_name);
+		else
+			debug("removed stale %s/%s\n", cache_dir, d->d_name);
+	}
+
+	closedir(dir);
+}
+
+/*
+ * Store what was drawn so far. Without a shadow surface this reads back the
+ * dumb buffer, which is slow, but only happens once per PNG.
+ */
+static void png_cache_store(cairo_t *cr, const char *png)
+{
+	cairo_surface_t *surface = cairo_get_target(cr);
+	struct modeset_dev *dev = ctx.dev;
+	char filename[PATH_MAX], tmp[PATH_MAX + 4];
+	size_t row_len = dev->width * dev->format->bpp / 8;
+	const unsigned char *data;
+	unsigned int y;
+	ssize_t ret;
+	int fd;
+
+	if (png_cache_filename(filename, sizeof(filename), png))
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		error("Failed to create %s: %m\n", tmp);
+		return;
+	}
+
+	cairo_surface_flush(surface);
+	data = cairo_image_surface_get_data(surface);
+
+	for (y = 0; y < dev->height; y++) {
+		ret = write(fd, data + (size_t)y * dev->stride, row_len);
+		if (ret != row_len)
+			break;
+	}
+
+	if (y < dev->height || fsync(fd)) {
+		error("Failed to write %s: %m\n", tmp);
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+
+	if (rename(tmp, filename)) {
+		error("Failed to rename %s: %m\n", tmp);
+		unlink(tmp);
+		return;
+	}
+
+	debug("cached %s as %s\n", png, filename);
+
+	png_cache_prune(strrchr(filename, '/') + 1);
+}
+
 static int png_import_backend_import_picture(cairo_t *cr, const char *filename)
 {
 	int image_width, image_height, surface_width, surface_height;
 	cairo_format_t image_fmt, surface_fmt;
 	cairo_surface_t *image, *surface;
 	cairo_status_t status;
-	int ret = 0;
 
 	image = cairo_image_surface_create_from_png(filename);
 	status = cairo_surface_status(image);
@@ -102,87 +242,255 @@ static int png_import_backend_import_picture(cairo_t *cr, const char *filename)
 	surface = cairo_get_target(cr);
 	image_fmt = cairo_image_surface_get_format(image);
 	surface_fmt = cairo_image_surface_get_format(surface);
-	if (image_fmt != surface_fmt) {
-		error("Error image format (%s) does not match the surface format (%s)\n",
-		      image_format_to_string(image_fmt), image_format_to_string(surface_fmt));
-		ret = -EINVAL;
-		goto out;
-	}
+	if (image_fmt != surface_fmt)
+		debug("converting image format %s to surface format %s\n",
+		      image_format_to_string(image_fmt),
+		      image_format_to_string(surface_fmt));
 
 	image_width = cairo_image_surface_get_width(image);
 	image_height = cairo_image_surface_get_height(image);
 	surface_width = cairo_image_surface_get_width(surface);
 	surface_height = cairo_image_surface_get_height(surface);
 
+	/*
+	 * The target isn't cleared beforehand. SOURCE stores the premultiplied
+	 * pixels, which is the same as blending over black.
+	 */
 	cairo_scale(cr, (double) surface_width/image_width, (double) surface_height/image_height);
 	cairo_set_source_surface(cr, image, 0, 0);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
-out:
 	cairo_surface_destroy(image);
 
+	png_cache_store(cr, filename);
+
+	return 0;
+}
+
+static uint32_t convert_to_cairo_format(uint32_t format)
+{
+	switch (format) {
+	case DRM_FORMAT_RGB565:
+		return CAIRO_FORMAT_RGB16_565;
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+		return CAIRO_FORMAT_ARGB32;
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 12, 0)
+	case DRM_FORMAT_XRGB2101010:
+		return CAIRO_FORMAT_RGB30;
+#endif
+	}
+	return CAIRO_FORMAT_INVALID;
+}
+
+/*
+ * With a shadow surface, an image in the connector's format is loaded
+ * straight into the dumb buffer. Text can't be drawn onto it afterwards if
+ * cairo can't render into that format, the XRGB8888 image is used then.
+ */
+static bool cairo_direct_possible(void)
+{
+	return convert_to_cairo_format(ctx.target->format->format) != CAIRO_FORMAT_INVALID ||
+	       !getenv("platsch_overlay_text");
+}
+
+static int raw_import_backend_detect(char *filename, size_t filename_sz,
+				     const char *ext)
+{
+	const struct platsch_format *formats[2];
+	struct modeset_dev *dev = ctx.dev;
+	struct stat s;
+	int ret = -ENOENT, i;
+
+	/*
+	 * Prefer an image in the connector's format, fall back to converting
+	 * an XRGB8888 one. The shadow surface is XRGB8888 already.
+	 */
+	formats[0] = ctx.target->format;
+	formats[1] = platsch_format_find("XRGB8888");
+
+	for (i = 0; i < ARRAY_SIZE(formats); i++) {
+		if (i == 0 && ctx.shadow && !cairo_direct_possible())
+			continue;
+
+		ret = snprintf(filename, filename_sz, "%s/%s-%ux%u-%s.%s",
+			       ctx.dir, ctx.base, dev->width, dev->height,
+			       formats[i]->name, ext);
+		if (ret >= filename_sz) {
+			error("Failed to fit filename into buffer\n");
+			return -EINVAL;
+		}
+
+		ret = stat(filename, &s);
+		if (!ret) {
+			ctx.file_format = formats[i];
+			return 0;
+		}
+	}
+
 	return ret;
 }
 
+static int raw_import_backend_import_picture(cairo_t *cr, const char *filename,
+					     int (*load)(struct modeset_dev *dev, void *dst,
+							 const char *filename,
+							 const struct platsch_format *format))
+{
+	cairo_surface_t *surface = cairo_get_target(cr);
+	struct modeset_dev *dev = ctx.dev;
+	unsigned char *image_buf;
+	int ret;
+
+	if (ctx.shadow && ctx.file_format == ctx.target->format) {
+		dev = ctx.target;
+		ret = load(dev, dev->bufs[dev->back_buf].map, filename,
+			   ctx.file_format);
+		if (ret)
+			return -EINVAL;
+		ctx.direct = true;
+		return 0;
+	}
+
+	cairo_surface_flush(surface);
+	image_buf = cairo_image_surface_get_data(surface);
+
+	ret = load(dev, image_buf, filename, ctx.file_format);
+	if (ret)
+		return -EINVAL;
+
+	cairo_surface_mark_dirty(surface);
+
+	return 0;
+}
+
 static int bin_import_backend_detect(char *filename, size_t filename_sz)
+{
+	return raw_import_backend_detect(filename, filename_sz, "bin");
+}
+
+static int bin_import_backend_import_picture(cairo_t *cr, const char *filename)
+{
+	return raw_import_backend_import_picture(cr, filename, blit_file);
+}
+
+static int rle_import_backend_detect(char *filename, size_t filename_sz)
+{
+	return raw_import_backend_detect(filename, filename_sz, "rle");
+}
+
+static int rle_import_backend_import_picture(cairo_t *cr, const char *filename)
+{
+	return raw_import_backend_import_picture(cr, filename, rle_file);
+}
+
+static int qoi_import_backend_detect(char *filename, size_t filename_sz)
 {
 	struct modeset_dev *dev = ctx.dev;
 	struct stat s;
 	int ret;
 
-	ret = snprintf(filename, filename_sz, "%s/%s-%ux%u-%s.bin",
-		       ctx.dir, ctx.base, dev->width, dev->height, dev->format->name);
+	ret = snprintf(filename, filename_sz, "%s/%s-%ux%u.qoi",
+		       ctx.dir, ctx.base, dev->width, dev->height);
 	if (ret >= filename_sz) {
 		error("Failed to fit filename into buffer\n");
 		return -EINVAL;
 	}
 
+	ctx.file_format = platsch_format_find("XRGB8888");
+
 	return stat(filename, &s);
 }
 
-static int bin_import_backend_import_picture(cairo_t *cr, const char *filename)
+static int qoi_import_backend_import_picture(cairo_t *cr, const char *filename)
 {
-	cairo_surface_t *surface = cairo_get_target(cr);
-	struct modeset_dev *dev = ctx.dev;
-	unsigned char *image_buf;
-	ssize_t size;
-	int fd_src;
+	return raw_import_backend_import_picture(cr, filename, qoi_file);
+}
+
+static int cache_import_backend_detect(char *filename, size_t filename_sz)
+{
+	char png[PATH_MAX];
+	struct stat s;
 	int ret;
 
-	cairo_surface_flush(surface);
-	image_buf = cairo_image_surface_get_data(surface);
+	ret = png_import_backend_detect(png, sizeof(png));
+	if (ret)
+		return ret;
 
-	fd_src = open(filename, O_RDONLY | O_CLOEXEC);
-	if (fd_src < 0) {
-		error("Failed to open %s: %m\n", filename);
-		return -EINVAL;
+	ret = png_cache_filename(filename, filename_sz, png);
+	if (ret)
+		return ret;
+
+	/* cached images are stored in the format of the surface */
+	ctx.file_format = ctx.dev->format;
+
+	return stat(filename, &s);
+}
+
+static int cache_import_backend_import_picture(cairo_t *cr, const char *filename)
+{
+	return raw_import_backend_import_picture(cr, filename, blit_file);
+}
+
+static int bundle_import_backend_detect(char *filename, size_t filename_sz)
+{
+	const struct platsch_format *format;
+
+	/* like for raw images, prefer one in the connector's format */
+	if (ctx.shadow && cairo_direct_possible() &&
+	    !bundle_lookup(ctx.target, ctx.dir, ctx.base, &format) &&
+	    format == ctx.target->format) {
+		ctx.file_format = format;
+		return 0;
 	}
 
-	size = readfull(fd_src, image_buf, dev->size);
-	if (size < dev->size) {
-		if (size < 0)
-			error("Failed to read from %s: %m\n", filename);
-		else
-			error("Could only read %zd/%u bytes from %s\n",
-			      size, dev->size, filename);
+	return bundle_lookup(ctx.dev, ctx.dir, ctx.base, &ctx.file_format);
+}
 
-		close(fd_src);
-		return -EINVAL;
+static int bundle_import_backend_import_picture(cairo_t *cr, const char *filename)
+{
+	cairo_surface_t *surface = cairo_get_target(cr);
+	struct modeset_dev *dev = ctx.target;
+	int ret;
+
+	if (ctx.shadow && ctx.file_format == dev->format) {
+		ret = bundle_draw(dev, dev->bufs[dev->back_buf].map, ctx.dir,
+				  ctx.base);
+		if (ret)
+			return -EINVAL;
+		ctx.direct = true;
+		return 0;
 	}
 
-	cairo_surface_mark_dirty(surface);
+	cairo_surface_flush(surface);
 
-	ret = close(fd_src);
-	if (ret < 0)
-		error("Failed to close image file\n");
+	ret = bundle_draw(ctx.dev, cairo_image_surface_get_data(surface),
+			  ctx.dir, ctx.base);
+	if (ret)
+		return -EINVAL;
 
-	return ret;
+	cairo_surface_mark_dirty(surface);
+
+	return 0;
 }
 
 static const struct import_backend supported_backends[] = {
 	{
+		.detect = bundle_import_backend_detect,
+		.import_picture = bundle_import_backend_import_picture,
+	}, {
+		.detect = rle_import_backend_detect,
+		.import_picture = rle_import_backend_import_picture,
+	}, {
 		.detect = bin_import_backend_detect,
 		.import_picture = bin_import_backend_import_picture,
+	}, {
+		.detect = qoi_import_backend_detect,
+		.import_picture = qoi_import_backend_import_picture,
+	}, {
+		.detect = cache_import_backend_detect,
+		.import_picture = cache_import_backend_import_picture,
 	}, {
 		.detect = png_import_backend_detect,
 		.import_picture = png_import_backend_import_picture,
@@ -193,22 +501,92 @@ static const struct import_backend supported_backends[] = {
 static int cairo_import_picture(cairo_t *cr)
 {
 	const struct import_backend *backend;
-	char filename[128];
+	char filename[PATH_MAX];
+	uint64_t start = trace_now();
 	int ret;
 
-	for (backend = supported_backends; backend; backend++)
+	for (backend = supported_backends; backend->detect; backend++)
 	{
 		ret = backend->detect(filename, sizeof(filename));
 		if (!ret)
 			break;
 	}
 
-	if (!backend) {
+	if (!backend->detect) {
 		debug("No suitable import backend found found\n");
 		return -EINVAL;
 	}
+	trace_phase(TRACE_DETECT, ctx.dev->conn_id, start);
+
+	start = trace_now();
+	ret = backend->import_picture(cr, filename);
+	trace_phase(TRACE_DECODE, ctx.dev->conn_id, start);
+
+	return ret;
+}
+
+/* Nearest whole device pixel, without pulling in libm */
+static int device_pixel(double v)
+{
+	return v < 0 ? -(int)(0.5 - v) : (int)(v + 0.5);
+}
+
+/*
+ * Draw text from a glyph atlas at the current point with the current source,
+ * like cairo_show_text(), but without loading a font. The glyphs are drawn
+ * unscaled, at the size the atlas was rendered at, and each one is placed on
+ * whole device pixels so the coverage isn't resampled. Nothing is drawn and
+ * -ENOENT returned if the atlas lacks one of the characters.
+ */
+int cairo_show_atlas_text(cairo_t *cr, const struct glyphs *g, const char *text)
+{
+	const struct glyphs_entry *e;
+	cairo_surface_t *atlas;
+	const char *p;
+	double x, y;
+	int gx, gy;
+
+	if (!g->count)
+		return -ENOENT;
+
+	for (p = text; *p;)
+		if (!glyphs_find(g, glyphs_utf8_next(&p)))
+			return -ENOENT;
+
+	atlas = cairo_image_surface_create_for_data((unsigned char *)g->pixels,
+						    CAIRO_FORMAT_A8, g->width,
+						    g->height, g->stride);
+	if (cairo_surface_status(atlas) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(atlas);
+		return -ENOMEM;
+	}
 
-	return backend->import_picture(cr, filename);
+	cairo_get_current_point(cr, &x, &y);
+	cairo_user_to_device(cr, &x, &y);
+
+	cairo_save(cr);
+	cairo_identity_matrix(cr);
+	for (p = text; *p;) {
+		e = glyphs_find(g, glyphs_utf8_next(&p));
+		if (e->width && e->height) {
+			gx = device_pixel(x) + e->bearing_x;
+			gy = device_pixel(y) + e->bearing_y;
+			cairo_save(cr);
+			cairo_rectangle(cr, gx, gy, e->width, e->height);
+			cairo_clip(cr);
+			cairo_mask_surface(cr, atlas, gx - e->x, gy - e->y);
+			cairo_restore(cr);
+		}
+		x += e->advance / 64.0;
+	}
+	cairo_restore(cr);
+
+	cairo_device_to_user(cr, &x, &y);
+	cairo_move_to(cr, x, y);
+
+	cairo_surface_destroy(atlas);
+
+	return 0;
 }
 
 /*
@@ -218,6 +596,9 @@ static int cairo_import_picture(cairo_t *cr)
 static void cairo_draw_text(cairo_t *cr)
 {
 	unsigned int xpos, ypos, size;
+	struct glyphs glyphs;
+	double dx, dy;
+	uint64_t start;
 	const char *env;
 	char *text;
 	int ret;
@@ -234,36 +615,77 @@ static void cairo_draw_text(cairo_t *cr)
 	}
 
 	debug("text:%s xpos:%u ypos:%u size:%u\n", text, xpos, ypos, size);
-	cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL,
-			       CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size(cr, (double) size);
+	start = trace_now();
 	cairo_set_source_rgb(cr, 0, 0, 0);
 	cairo_move_to(cr, xpos, ypos);
-	cairo_show_text(cr, text);
+
+	/*
+	 * A baked atlas spares initializing fontconfig at boot. Its glyphs
+	 * aren't scaled along with the splash, so it is looked up by the size
+	 * the text has on the display.
+	 */
+	dx = 0;
+	dy = size;
+	cairo_user_to_device_distance(cr, &dx, &dy);
+	glyphs_open(&glyphs, ctx.dir, ctx.base, "Sans",
+		    device_pixel(dy < 0 ? -dy : dy));
+	if (cairo_show_atlas_text(cr, &glyphs, text)) {
+		cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL,
+				       CAIRO_FONT_WEIGHT_NORMAL);
+		cairo_set_font_size(cr, (double) size);
+		cairo_show_text(cr, text);
+	}
+	glyphs_close(&glyphs);
+	trace_phase(TRACE_TEXT, ctx.dev->conn_id, start);
 
 	free(text);
 }
 
-static uint32_t convert_to_cairo_format(uint32_t format)
+struct png_stream {
+	const unsigned char *data;
+	size_t size;
+};
+
+static cairo_status_t png_stream_read(void *closure, unsigned char *data,
+				      unsigned int length)
 {
-	switch (format) {
-	case DRM_FORMAT_RGB565:
-		return CAIRO_FORMAT_RGB16_565;
-	case DRM_FORMAT_XRGB8888:
-		return CAIRO_FORMAT_ARGB32;
-	}
-	return CAIRO_FORMAT_INVALID;
+	struct png_stream *st = closure;
+
+	if (length > st->size)
+		return CAIRO_STATUS_READ_ERROR;
+
+	memcpy(data, st->data, length);
+	st->data += length;
+	st->size -= length;
+
+	return CAIRO_STATUS_SUCCESS;
 }
 
-cairo_t *cairo_init(struct modeset_dev *dev, const char *dir, const char *base)
+/*
+ * Load a PNG, taken from the bundle if it contains a sprite with the same
+ * file name.
+ */
+cairo_surface_t *cairo_load_png(const char *filename, const char *dir,
+				const char *base)
+{
+	struct png_stream st;
+	const char *name;
+
+	name = strrchr(filename, '/');
+	name = name ? name + 1 : filename;
+
+	st.data = bundle_asset(dir, base, name, &st.size);
+	if (st.data)
+		return cairo_image_surface_create_from_png_stream(png_stream_read, &st);
+
+	return cairo_image_surface_create_from_png(filename);
+}
+
+static cairo_t *cairo_create_for(cairo_surface_t *surface, struct modeset_dev *dev)
 {
-	cairo_surface_t *surface;
 	cairo_status_t status;
 	cairo_t *cr;
 
-	surface = cairo_image_surface_create_for_data(dev->map,
-			convert_to_cairo_format(dev->format->format),
-			dev->width, dev->height, dev->stride);
 	status = cairo_surface_status(surface);
 	if (status != CAIRO_STATUS_SUCCESS) {
 		error("Failed to create cairo surface (%s)\n", cairo_status_to_string(status));
@@ -282,13 +704,86 @@ cairo_t *cairo_init(struct modeset_dev *dev, const char *dir, const char *base)
 	cairo_rectangle(cr, 0, 0, dev->width, dev->height);
 	cairo_clip(cr);
 
+	return cr;
+}
+
+cairo_t *cairo_init(struct modeset_dev *dev, const char *dir, const char *base)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	surface = cairo_image_surface_create_for_data(dev->bufs[dev->back_buf].map,
+			convert_to_cairo_format(dev->format->format),
+			dev->width, dev->height, dev->stride);
+	cr = cairo_create_for(surface, dev);
+	if (!cr)
+		return NULL;
+
 	ctx.dev = dev;
 	ctx.dir = dir;
 	ctx.base = base;
+	ctx.shadow = false;
+	ctx.target = dev;
+	ctx.direct = false;
 
 	return cr;
 }
 
+/*
+ * Draw into an XRGB8888 surface in cached memory instead, which is converted
+ * into the dumb buffer in the end. Used for formats cairo can't render into
+ * and to dither RGB565.
+ */
+static cairo_t *cairo_init_shadow(struct modeset_dev *dev, const char *dir,
+				  const char *base)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, dev->width,
+					     dev->height);
+	cr = cairo_create_for(surface, dev);
+	if (!cr)
+		return NULL;
+
+	ctx.shadow_dev = *dev;
+	ctx.shadow_dev.format = platsch_format_find("XRGB8888");
+	ctx.shadow_dev.stride = cairo_image_surface_get_stride(surface);
+	ctx.dev = &ctx.shadow_dev;
+	ctx.dir = dir;
+	ctx.base = base;
+	ctx.shadow = true;
+	ctx.target = dev;
+	ctx.direct = false;
+
+	return cr;
+}
+
+static bool cairo_needs_shadow(struct modeset_dev *dev)
+{
+	if (convert_to_cairo_format(dev->format->format) == CAIRO_FORMAT_INVALID)
+		return true;
+
+	return dev->format->format == DRM_FORMAT_RGB565 && convert_dither();
+}
+
+static int cairo_commit_shadow(cairo_t *cr, struct modeset_dev *dev)
+{
+	cairo_surface_t *surface = cairo_get_target(cr);
+	int ret;
+
+	cairo_surface_flush(surface);
+	ret = convert_rows(dev->bufs[dev->back_buf].map, dev->stride,
+			   dev->format->format,
+			   cairo_image_surface_get_data(surface),
+			   cairo_image_surface_get_stride(surface),
+			   dev->width, dev->height, 0);
+	if (ret)
+		error("Cannot convert to %s\n", dev->format->name);
+
+	return ret;
+}
+
 static void cairo_deinit(cairo_t *cr)
 {
 	cairo_surface_t *surface = cairo_get_target(cr);
@@ -299,10 +794,14 @@ static void cairo_deinit(cairo_t *cr)
 
 int cairo_draw_buffer(struct modeset_dev *dev, const char *dir, const char *base)
 {
+	bool shadow = cairo_needs_shadow(dev);
 	cairo_t *cr;
 	int ret;
 
-	cr = cairo_init(dev, dir, base);
+	if (shadow)
+		cr = cairo_init_shadow(dev, dir, base);
+	else
+		cr = cairo_init(dev, dir, base);
 	if (!cr)
 		return -EINVAL;
 
@@ -310,7 +809,21 @@ int cairo_draw_buffer(struct modeset_dev *dev, const char *dir, const char *base
 	if (ret)
 		goto out;
 
+	/* the image went into the dumb buffer, draw the text there, too */
+	if (ctx.direct) {
+		cairo_deinit(cr);
+		if (!getenv("platsch_overlay_text"))
+			return 0;
+		cr = cairo_init(dev, dir, base);
+		if (!cr)
+			return -EINVAL;
+		shadow = false;
+	}
+
 	cairo_draw_text(cr);
+
+	if (shadow)
+		ret = cairo_commit_shadow(cr, dev);
 out:
 	cairo_deinit(cr);
 
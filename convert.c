@@ -0,0 +1,396 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drm_fourcc.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "libplatsch.h"
+
+/*
+ * Conversion from XRGB8888 master images into the format of a connector.
+ *
+ * Pixels are converted in chunks into a small cached buffer which is then
+ * streamed into the dumb buffer with blit_rows(), so the write-combined
+ * mapping is never read and written only once.
+ */
+
+#define CONVERT_CHUNK 1024 /* pixels, a multiple of 16 */
+
+/* 4x4 Bayer matrix, values 0..15 */
+static const uint8_t bayer4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/*
+ * Per-byte offsets added before truncating a row to RGB565, laid out like
+ * four XRGB8888 pixels: 5 bit channels are offset by 0..7, green by 0..3.
+ */
+static uint8_t dither565[4][16];
+static bool dither;
+
+struct converter {
+	uint32_t format;
+	unsigned int cpp;
+	void (*row)(void *dst, const uint32_t *src, unsigned int n, unsigned int y);
+};
+
+static inline uint16_t pack565(uint32_t p)
+{
+	return (p >> 8 & 0xf800) | (p >> 5 & 0x07e0) | (p >> 3 & 0x001f);
+}
+
+static inline uint32_t add_sat(uint32_t p, const uint8_t *d)
+{
+	unsigned int b = (p & 0xff) + d[0];
+	unsigned int g = (p >> 8 & 0xff) + d[1];
+	unsigned int r = (p >> 16 & 0xff) + d[2];
+
+	return (r > 255 ? 255 : r) << 16 | (g > 255 ? 255 : g) << 8 |
+	       (b > 255 ? 255 : b);
+}
+
+static void rgb565_generic(void *dst, const uint32_t *src, unsigned int n,
+			   unsigned int y)
+{
+	uint16_t *d = dst;
+	unsigned int x;
+
+	if (!dither) {
+		for (x = 0; x < n; x++)
+			d[x] = pack565(src[x]);
+		return;
+	}
+
+	for (x = 0; x < n; x++)
+		d[x] = pack565(add_sat(src[x], &dither565[y & 3][(x & 3) * 4]));
+}
+
+static void xbgr8888_generic(void *dst, const uint32_t *src, unsigned int n,
+			     unsigned int y)
+{
+	uint32_t *d = dst;
+	unsigned int x;
+
+	for (x = 0; x < n; x++)
+		d[x] = (src[x] & 0xff00ff00) | (src[x] >> 16 & 0xff) |
+		       (src[x] & 0xff) << 16;
+}
+
+/* DRM_FORMAT_BGR888 is R, G, B in memory order */
+static void bgr888_generic(void *dst, const uint32_t *src, unsigned int n,
+			   unsigned int y)
+{
+	uint8_t *d = dst;
+	unsigned int x;
+
+	for (x = 0; x < n; x++, d += 3) {
+		d[0] = src[x] >> 16;
+		d[1] = src[x] >> 8;
+		d[2] = src[x];
+	}
+}
+
+/* 8 -> 10 bit by replicating the top bits, so white stays white */
+static inline uint32_t pack2101010(uint32_t p)
+{
+	uint32_t r = p >> 16 & 0xff, g = p >> 8 & 0xff, b = p & 0xff;
+
+	return (r << 2 | r >> 6) << 20 | (g << 2 | g >> 6) << 10 | (b << 2 | b >> 6);
+}
+
+static void xrgb2101010_generic(void *dst, const uint32_t *src, unsigned int n,
+				unsigned int y)
+{
+	uint32_t *d = dst;
+	unsigned int x;
+
+	for (x = 0; x < n; x++)
+		d[x] = pack2101010(src[x]);
+}
+
+#if defined(__x86_64__)
+static inline __m128i pack565_sse2(__m128i p)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+	__m128i v = _mm_or_si128(_mm_or_si128(r, g), b);
+
+	/* sign extend, so the signed saturation of packs keeps all 16 bits */
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+static void rgb565_sse2(void *dst, const uint32_t *src, unsigned int n,
+			unsigned int y)
+{
+	__m128i d = dither ? _mm_loadu_si128((const __m128i *)dither565[y & 3]) :
+			     _mm_setzero_si128();
+	uint16_t *out = dst;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= n; x += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + x + 4));
+
+		a = pack565_sse2(_mm_adds_epu8(a, d));
+		b = pack565_sse2(_mm_adds_epu8(b, d));
+		_mm_storeu_si128((__m128i *)(out + x), _mm_packs_epi32(a, b));
+	}
+	rgb565_generic(out + x, src + x, n - x, y);
+}
+
+static void xbgr8888_sse2(void *dst, const uint32_t *src, unsigned int n,
+			  unsigned int y)
+{
+	const __m128i ag = _mm_set1_epi32(0xff00ff00);
+	const __m128i lo = _mm_set1_epi32(0xff);
+	uint32_t *out = dst;
+	unsigned int x;
+
+	for (x = 0; x + 4 <= n; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), lo);
+		__m128i b = _mm_slli_epi32(_mm_and_si128(p, lo), 16);
+
+		p = _mm_or_si128(_mm_and_si128(p, ag), _mm_or_si128(r, b));
+		_mm_storeu_si128((__m128i *)(out + x), p);
+	}
+	xbgr8888_generic(out + x, src + x, n - x, y);
+}
+
+static void xrgb2101010_sse2(void *dst, const uint32_t *src, unsigned int n,
+			     unsigned int y)
+{
+	const __m128i lo = _mm_set1_epi32(0xff);
+	uint32_t *out = dst;
+	unsigned int x;
+
+	for (x = 0; x + 4 <= n; x += 4) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+		__m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), lo);
+		__m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), lo);
+		__m128i b = _mm_and_si128(p, lo);
+
+		r = _mm_or_si128(_mm_slli_epi32(r, 2), _mm_srli_epi32(r, 6));
+		g = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 6));
+		b = _mm_or_si128(_mm_slli_epi32(b, 2), _mm_srli_epi32(b, 6));
+		p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 20),
+					      _mm_slli_epi32(g, 10)), b);
+		_mm_storeu_si128((__m128i *)(out + x), p);
+	}
+	xrgb2101010_generic(out + x, src + x, n - x, y);
+}
+
+__attribute__((target("ssse3")))
+static void bgr888_ssse3(void *dst, const uint32_t *src, unsigned int n,
+			 unsigned int y)
+{
+	/* 4 pixels B G R X -> 12 bytes R G B */
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+					   -1, -1, -1, -1);
+	uint8_t *out = dst;
+	unsigned int x;
+
+	/* the store writes 4 bytes past the group, keep the last one scalar */
+	for (x = 0; x + 8 <= n; x += 4, out += 12) {
+		__m128i p = _mm_loadu_si128((const __m128i *)(src + x));
+
+		_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(p, shuf));
+	}
+	bgr888_generic(out, src + x, n - x, y);
+}
+#endif /* __x86_64__ */
+
+#if defined(__aarch64__)
+static void rgb565_neon(void *dst, const uint32_t *src, unsigned int n,
+			unsigned int y)
+{
+	uint8_t db[16] = { 0 }, dg[16] = { 0 }, dr[16] = { 0 };
+	uint16_t *out = dst;
+	unsigned int x;
+
+	if (dither) {
+		for (x = 0; x < 16; x++) {
+			db[x] = dither565[y & 3][(x & 3) * 4 + 0];
+			dg[x] = dither565[y & 3][(x & 3) * 4 + 1];
+			dr[x] = dither565[y & 3][(x & 3) * 4 + 2];
+		}
+	}
+
+	for (x = 0; x + 16 <= n; x += 16) {
+		uint8x16x4_t p = vld4q_u8((const uint8_t *)(src + x));
+		uint8x16_t b = vqaddq_u8(p.val[0], vld1q_u8(db));
+		uint8x16_t g = vqaddq_u8(p.val[1], vld1q_u8(dg));
+		uint8x16_t r = vqaddq_u8(p.val[2], vld1q_u8(dr));
+		uint16x8_t lo, hi;
+
+		/* r:5 g:6 b:5 by shifting each channel in below the last one */
+		lo = vshll_n_u8(vget_low_u8(r), 8);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(g), 8), 5);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(b), 8), 11);
+		hi = vshll_n_u8(vget_high_u8(r), 8);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(g), 8), 5);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(b), 8), 11);
+
+		vst1q_u16(out + x, lo);
+		vst1q_u16(out + x + 8, hi);
+	}
+	rgb565_generic(out + x, src + x, n - x, y);
+}
+
+static void bgr888_neon(void *dst, const uint32_t *src, unsigned int n,
+			unsigned int y)
+{
+	uint8_t *out = dst;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= n; x += 16, out += 48) {
+		uint8x16x4_t p = vld4q_u8((const uint8_t *)(src + x));
+		uint8x16x3_t d = {{ p.val[2], p.val[1], p.val[0] }};
+
+		vst3q_u8(out, d);
+	}
+	bgr888_generic(out, src + x, n - x, y);
+}
+
+static void xbgr8888_neon(void *dst, const uint32_t *src, unsigned int n,
+			  unsigned int y)
+{
+	uint32_t *out = dst;
+	unsigned int x;
+
+	for (x = 0; x + 16 <= n; x += 16) {
+		uint8x16x4_t p = vld4q_u8((const uint8_t *)(src + x));
+		uint8x16_t b = p.val[0];
+
+		p.val[0] = p.val[2];
+		p.val[2] = b;
+		vst4q_u8((uint8_t *)(out + x), p);
+	}
+	xbgr8888_generic(out + x, src + x, n - x, y);
+}
+
+static inline uint16x8_t expand10_neon(uint8x8_t c)
+{
+	return vorrq_u16(vshll_n_u8(c, 2), vmovl_u8(vshr_n_u8(c, 6)));
+}
+
+static void xrgb2101010_neon(void *dst, const uint32_t *src, unsigned int n,
+			     unsigned int y)
+{
+	uint32_t *out = dst;
+	unsigned int x;
+
+	for (x = 0; x + 8 <= n; x += 8) {
+		uint8x8x4_t p = vld4_u8((const uint8_t *)(src + x));
+		uint16x8_t r = expand10_neon(p.val[2]);
+		uint16x8_t g = expand10_neon(p.val[1]);
+		uint16x8_t b = expand10_neon(p.val[0]);
+		uint32x4_t lo, hi;
+
+		lo = vshlq_n_u32(vmovl_u16(vget_low_u16(r)), 20);
+		lo = vorrq_u32(lo, vshlq_n_u32(vmovl_u16(vget_low_u16(g)), 10));
+		lo = vorrq_u32(lo, vmovl_u16(vget_low_u16(b)));
+		hi = vshlq_n_u32(vmovl_u16(vget_high_u16(r)), 20);
+		hi = vorrq_u32(hi, vshlq_n_u32(vmovl_u16(vget_high_u16(g)), 10));
+		hi = vorrq_u32(hi, vmovl_u16(vget_high_u16(b)));
+
+		vst1q_u32(out + x, lo);
+		vst1q_u32(out + x + 4, hi);
+	}
+	xrgb2101010_generic(out + x, src + x, n - x, y);
+}
+#endif /* __aarch64__ */
+
+static struct converter converters[] = {
+	{ DRM_FORMAT_RGB565, 2, rgb565_generic },
+	{ DRM_FORMAT_BGR888, 3, bgr888_generic },
+	{ DRM_FORMAT_XBGR8888, 4, xbgr8888_generic },
+	{ DRM_FORMAT_XRGB2101010, 4, xrgb2101010_generic },
+};
+
+__attribute__((constructor))
+static void convert_init(void)
+{
+	const char *env;
+	unsigned int i, j;
+
+	env = getenv("platsch_dither");
+	dither = env && strcmp(env, "0");
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			dither565[i][j * 4 + 0] = bayer4[i][j] >> 1;
+			dither565[i][j * 4 + 1] = bayer4[i][j] >> 2;
+			dither565[i][j * 4 + 2] = bayer4[i][j] >> 1;
+		}
+	}
+
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	converters[0].row = rgb565_sse2;
+	converters[2].row = xbgr8888_sse2;
+	converters[3].row = xrgb2101010_sse2;
+	if (__builtin_cpu_supports("ssse3"))
+		converters[1].row = bgr888_ssse3;
+#elif defined(__aarch64__)
+	converters[0].row = rgb565_neon;
+	converters[1].row = bgr888_neon;
+	converters[2].row = xbgr8888_neon;
+	converters[3].row = xrgb2101010_neon;
+#endif
+}
+
+/* platsch_dither, read once at startup */
+bool convert_dither(void)
+{
+	return dither;
+}
+
+/*
+ * Convert rows of an XRGB8888 image into dst_format while copying them into
+ * dst. y is the row of the first line in the image and selects the dither
+ * pattern. Returns -EINVAL if there is no conversion into dst_format.
+ */
+int convert_rows(void *dst, uint32_t dst_stride, uint32_t dst_format,
+		 const void *src, uint32_t src_stride, uint32_t width,
+		 uint32_t rows, uint32_t y)
+{
+	uint8_t chunk[CONVERT_CHUNK * 4] __attribute__((aligned(64)));
+	const struct converter *conv = NULL;
+	const uint8_t *s = src;
+	uint8_t *d = dst;
+	unsigned int i, x, n;
+
+	if (dst_format == DRM_FORMAT_XRGB8888) {
+		blit_rows(dst, dst_stride, src, src_stride, width * 4, rows);
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(converters); i++)
+		if (converters[i].format == dst_format)
+			conv = &converters[i];
+	if (!conv)
+		return -EINVAL;
+
+	for (; rows; rows--, y++, d += dst_stride, s += src_stride) {
+		for (x = 0; x < width; x += n) {
+			n = width - x < CONVERT_CHUNK ? width - x : CONVERT_CHUNK;
+			conv->row(chunk, (const uint32_t *)s + x, n, y);
+			blit_rows(d + x * conv->cpp, 0, chunk, 0, n * conv->cpp, 1);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,210 @@
+#include <endian.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "glyphs.h"
+
+/* Decode the next UTF-8 character of *s, invalid bytes are taken as Latin-1 */
+uint32_t glyphs_utf8_next(const char **s)
+{
+	const unsigned char *p = (const unsigned char *)*s;
+	uint32_t cp;
+	int n, i;
+
+	if (p[0] < 0x80) {
+		cp = p[0];
+		n = 0;
+	} else if ((p[0] & 0xe0) == 0xc0) {
+		cp = p[0] & 0x1f;
+		n = 1;
+	} else if ((p[0] & 0xf0) == 0xe0) {
+		cp = p[0] & 0x0f;
+		n = 2;
+	} else if ((p[0] & 0xf8) == 0xf0) {
+		cp = p[0] & 0x07;
+		n = 3;
+	} else {
+		*s += 1;
+		return p[0];
+	}
+
+	for (i = 1; i <= n; i++) {
+		if ((p[i] & 0xc0) != 0x80) {
+			*s += 1;
+			return p[0];
+		}
+		cp = cp << 6 | (p[i] & 0x3f);
+	}
+
+	*s += n + 1;
+
+	return cp;
+}
+
+static int glyphs_load(struct glyphs *g, const void *data, size_t size,
+		       const char *name)
+{
+	const struct glyphs_header *hdr = data;
+	const struct glyphs_entry *le;
+	unsigned int count, width, height, stride, i;
+	size_t pixels;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, GLYPHS_MAGIC, sizeof(hdr->magic)) ||
+	    le32toh(hdr->version) != GLYPHS_VERSION) {
+		error("%s is no glyph atlas of version %u\n", name,
+		      GLYPHS_VERSION);
+		return -EINVAL;
+	}
+
+	count = le32toh(hdr->count);
+	width = le32toh(hdr->width);
+	height = le32toh(hdr->height);
+	stride = le32toh(hdr->stride);
+
+	pixels = sizeof(*hdr) + (size_t)count * sizeof(struct glyphs_entry);
+	if (stride < width || stride % 4 ||
+	    size < pixels || size - pixels < (size_t)stride * height) {
+		error("%s is truncated\n", name);
+		return -EINVAL;
+	}
+
+	g->entries = malloc(count * sizeof(*g->entries));
+	if (!g->entries)
+		return -ENOMEM;
+
+	le = (const void *)(hdr + 1);
+	for (i = 0; i < count; i++) {
+		g->entries[i].codepoint = le32toh(le[i].codepoint);
+		g->entries[i].x = le16toh(le[i].x);
+		g->entries[i].y = le16toh(le[i].y);
+		g->entries[i].width = le16toh(le[i].width);
+		g->entries[i].height = le16toh(le[i].height);
+		g->entries[i].bearing_x = le16toh(le[i].bearing_x);
+		g->entries[i].bearing_y = le16toh(le[i].bearing_y);
+		g->entries[i].advance = le32toh(le[i].advance);
+	}
+
+	g->count = count;
+	g->width = width;
+	g->height = height;
+	g->stride = stride;
+	g->pixels = (const uint8_t *)data + pixels;
+
+	return 0;
+}
+
+/*
+ * Find the atlas platsch-glyphs made for font at size, in the bundle or as
+ * <dir>/<base>-<font>-<size>.glyphs. Returns -ENOENT if there is none, text
+ * is then drawn with cairo's own font rendering.
+ */
+int glyphs_open(struct glyphs *g, const char *dir, const char *base,
+		const char *font, unsigned int size)
+{
+	char name[128], path[PATH_MAX];
+	const void *data;
+	size_t len;
+	int ret;
+
+	memset(g, 0, sizeof(*g));
+
+	ret = snprintf(name, sizeof(name), "%s-%s-%u.glyphs", base, font, size);
+	if (ret >= sizeof(name))
+		return -ENOENT;
+
+	data = bundle_asset(dir, base, name, &len);
+	if (data)
+		return glyphs_load(g, data, len, name);
+
+	ret = snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (ret >= sizeof(path) || access(path, R_OK))
+		return -ENOENT;
+
+	ret = map_file(path, &data, &len, false);
+	if (ret)
+		return ret;
+
+	ret = glyphs_load(g, data, len, path);
+	if (ret) {
+		if (data)
+			munmap((void *)data, len);
+		return ret;
+	}
+
+	g->map = data;
+	g->map_size = len;
+
+	return 0;
+}
+
+void glyphs_close(struct glyphs *g)
+{
+	if (g->map)
+		munmap((void *)g->map, g->map_size);
+	free(g->entries);
+	memset(g, 0, sizeof(*g));
+}
+
+const struct glyphs_entry *glyphs_find(const struct glyphs *g, uint32_t codepoint)
+{
+	unsigned int lo = 0, hi = g->count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (g->entries[mid].codepoint == codepoint)
+			return &g->entries[mid];
+		if (g->entries[mid].codepoint < codepoint)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
+
+/*
+ * Measure text like cairo_text_extents() does. Returns -ENOENT if the atlas
+ * lacks one of its characters.
+ */
+int glyphs_text_extents(const struct glyphs *g, const char *text,
+			struct glyphs_extents *ext)
+{
+	const struct glyphs_entry *e;
+	double x = 0, x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+	bool inked = false;
+
+	while (*text) {
+		e = glyphs_find(g, glyphs_utf8_next(&text));
+		if (!e)
+			return -ENOENT;
+
+		if (e->width && e->height) {
+			if (!inked || x + e->bearing_x < x1)
+				x1 = x + e->bearing_x;
+			if (!inked || e->bearing_y < y1)
+				y1 = e->bearing_y;
+			if (!inked || x + e->bearing_x + e->width > x2)
+				x2 = x + e->bearing_x + e->width;
+			if (!inked || e->bearing_y + e->height > y2)
+				y2 = e->bearing_y + e->height;
+			inked = true;
+		}
+		x += e->advance / 64.0;
+	}
+
+	ext->x_bearing = x1;
+	ext->y_bearing = y1;
+	ext->width = x2 - x1;
+	ext->height = y2 - y1;
+	ext->x_advance = x;
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef __GLYPHS_H__
+#define __GLYPHS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pre-rasterized glyph atlas (<base>-<font>-<size>.glyphs)
+ *
+ * The glyphs of one font at one size, rendered by platsch-glyphs, so text can
+ * be drawn without fontconfig and FreeType:
+ *
+ *   struct glyphs_header
+ *   struct glyphs_entry[count], sorted by codepoint
+ *   8 bit alpha atlas, height rows of stride bytes
+ *
+ * Glyph metrics are in pixels relative to the pen position on the baseline,
+ * y grows downwards like in cairo. The glyphs are drawn at the size they were
+ * rendered at, so size is in display pixels. Integers in the header and the
+ * entries are written little endian, the atlas is one byte per pixel.
+ */
+
+#define GLYPHS_MAGIC		"PGLY"
+#define GLYPHS_VERSION		1
+#define GLYPHS_FONT_LEN		64
+
+struct glyphs_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t size;		/* font size the glyphs were rendered at */
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;	/* multiple of 4, as cairo wants for A8 */
+	uint32_t reserved;
+	char font[GLYPHS_FONT_LEN];
+};
+
+struct glyphs_entry {
+	uint32_t codepoint;
+	uint16_t x;		/* position in the atlas */
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	int16_t bearing_x;	/* top left corner relative to the pen */
+	int16_t bearing_y;
+	int32_t advance;	/* pen movement in 1/64 pixels */
+};
+
+/*
+ * An atlas mapped from its own file or found in the bundle, with the header
+ * and entries converted to host byte order
+ */
+struct glyphs {
+	unsigned int count;	/* 0 if no atlas was found */
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	struct glyphs_entry *entries;
+	const uint8_t *pixels;
+	const void *map;	/* NULL if the atlas is part of the bundle */
+	size_t map_size;
+};
+
+/* Same meaning as the fields of cairo_text_extents_t */
+struct glyphs_extents {
+	double x_bearing;
+	double y_bearing;
+	double width;
+	double height;
+	double x_advance;
+};
+
+#endif /* __GLYPHS_H__ */
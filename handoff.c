@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "handoff.h"
+
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR 0
+#endif
+
+/*
+ * A path starting with '@' names a socket in the abstract namespace, which
+ * doesn't depend on any filesystem. When platsch runs as PID 1, init mounts
+ * over e.g. /run later and hides a socket bound there. Returns the length of
+ * addr.
+ */
+static int handoff_addr(const char *path, struct sockaddr_un *addr)
+{
+	size_t len = strlen(path);
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (len >= sizeof(addr->sun_path)) {
+		error("Socket path %s is too long\n", path);
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr->sun_path, path);
+
+	if (path[0] != '@')
+		return sizeof(*addr);
+
+	addr->sun_path[0] = '\0';
+	return offsetof(struct sockaddr_un, sun_path) + len;
+}
+
+static int send_fd(int sock, const void *data, size_t size, int fd)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct iovec iov = { .iov_base = (void *)data, .iov_len = size };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != size)
+		return -errno ?: -EIO;
+
+	return 0;
+}
+
+/* Send the buffer each connector scans out, the fds are only ours meanwhile */
+static int handoff_send(int sock, struct modeset_dev *list)
+{
+	struct handoff_msg msg = {
+		.magic = HANDOFF_MAGIC,
+		.version = HANDOFF_VERSION,
+		.modifier = DRM_FORMAT_MOD_LINEAR,
+	};
+	struct modeset_dev *iter;
+	struct modeset_buf *buf;
+	int fd, ret;
+
+	for (iter = list; iter; iter = iter->next)
+		msg.count++;
+
+	for (iter = list; iter; iter = iter->next, msg.index++) {
+		buf = &iter->bufs[iter->front_buf >= 0 ? iter->front_buf : 0];
+
+		ret = drmPrimeHandleToFD(display_fd(), buf->handle,
+					 DRM_CLOEXEC | DRM_RDWR, &fd);
+		if (ret) {
+			error("Failed to export buffer of connector #%u: %m\n",
+			      iter->conn_id);
+			return -errno;
+		}
+
+		msg.conn_id = iter->conn_id;
+		msg.crtc_id = iter->crtc_id;
+		msg.width = iter->width;
+		msg.height = iter->height;
+		msg.stride = iter->stride;
+		msg.format = iter->format->format;
+		msg.x = iter->x;
+		msg.y = iter->y;
+
+		ret = send_fd(sock, &msg, sizeof(msg), fd);
+		close(fd);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * The dma-bufs give write access to what is on screen, and an abstract
+ * socket can be connected to by anyone, so only root and uid may take over.
+ */
+static bool peer_allowed(int sock, uid_t uid)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+		error("Failed to get handoff peer credentials: %m\n");
+		return false;
+	}
+
+	if (cred.uid == 0 || cred.uid == uid)
+		return true;
+
+	error("Refusing handoff to pid %d with uid %u\n", cred.pid, cred.uid);
+	return false;
+}
+
+/*
+ * Serve the buffers shown on list at path, see handoff.h. Only processes
+ * running as root or as uid ((uid_t)-1 for none) are served. Returns 0 once a
+ * successor acknowledged taking over, the caller should then exit.
+ */
+int handoff_serve(struct modeset_dev *list, const char *path, uid_t uid)
+{
+	struct sockaddr_un addr;
+	struct handoff_ack ack;
+	int lsock, sock, len, ret;
+	bool abstract = path[0] == '@';
+
+	len = handoff_addr(path, &addr);
+	if (len < 0)
+		return len;
+
+	lsock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (lsock < 0) {
+		error("Failed to create handoff socket: %m\n");
+		return -errno;
+	}
+
+	if (!abstract)
+		unlink(path);
+	if (bind(lsock, (struct sockaddr *)&addr, len) ||
+	    listen(lsock, 1)) {
+		error("Failed to listen on %s: %m\n", path);
+		ret = -errno;
+		close(lsock);
+		return ret;
+	}
+
+	for (;;) {
+		sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			error("Failed to accept on %s: %m\n", path);
+			ret = -errno;
+			break;
+		}
+
+		if (!peer_allowed(sock, uid)) {
+			close(sock);
+			continue;
+		}
+
+		/* a successor that goes away without ack leaves us in charge */
+		ret = handoff_send(sock, list);
+		if (!ret && recv(sock, &ack, sizeof(ack), 0) == sizeof(ack) &&
+		    ack.magic == HANDOFF_MAGIC) {
+			close(sock);
+			ret = 0;
+			break;
+		}
+		close(sock);
+	}
+
+	close(lsock);
+	if (!abstract)
+		unlink(path);
+
+	return ret;
+}
+
+/*
+ * Successor side: connect to path and receive up to max buffers into msgs
+ * and fds. Returns the socket to acknowledge on with handoff_ack(), and the
+ * number of buffers in *count.
+ */
+int handoff_receive(const char *path, struct handoff_msg *msgs, int *fds,
+		    unsigned int max, unsigned int *count)
+{
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct sockaddr_un addr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	unsigned int i;
+	ssize_t size;
+	int sock, len, fd, ret = 0;
+
+	len = handoff_addr(path, &addr);
+	if (len < 0)
+		return len;
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -errno;
+
+	if (connect(sock, (struct sockaddr *)&addr, len)) {
+		ret = -errno;
+		close(sock);
+		return ret;
+	}
+
+	for (i = 0; i < max; i++) {
+		iov.iov_base = &msgs[i];
+		iov.iov_len = sizeof(msgs[i]);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cbuf;
+		msg.msg_controllen = sizeof(cbuf);
+
+		size = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+
+		/* take the fd first, so it is closed if the message is bad */
+		fd = -1;
+		cmsg = size >= 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+		if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+		if (size != sizeof(msgs[i]) || fd < 0 ||
+		    msgs[i].magic != HANDOFF_MAGIC ||
+		    msgs[i].version != HANDOFF_VERSION) {
+			if (fd >= 0)
+				close(fd);
+			ret = -EPROTO;
+			break;
+		}
+		fds[i] = fd;
+
+		if (msgs[i].index + 1 == msgs[i].count)
+			break;
+	}
+
+	if (ret || i == max) {
+		while (i--)
+			close(fds[i]);
+		close(sock);
+		return ret ?: -ENOSPC;
+	}
+
+	*count = i + 1;
+
+	return sock;
+}
+
+/* Tell platsch it may exit, then close the handoff socket */
+int handoff_ack(int sock)
+{
+	struct handoff_ack ack = { .magic = HANDOFF_MAGIC };
+	int ret = 0;
+
+	if (send(sock, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack))
+		ret = -errno ?: -EIO;
+	close(sock);
+
+	return ret;
+}
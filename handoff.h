@@ -0,0 +1,40 @@
+#ifndef __HANDOFF_H__
+#define __HANDOFF_H__
+
+#include <stdint.h>
+
+/*
+ * Scanout handoff (platsch_handoff=<socket>, @<name> for the abstract namespace)
+ *
+ * Instead of keeping the DRM device open forever, platsch listens on a
+ * SOCK_SEQPACKET unix socket. A successor that connects gets one
+ * struct handoff_msg per connector, each carrying the dma-buf of the buffer
+ * that connector scans out as SCM_RIGHTS ancillary data. Once it scans out
+ * the same pixels from its own framebuffers, it sends a struct handoff_ack and
+ * platsch exits, which removes its framebuffers. All values are host endian.
+ */
+
+#define HANDOFF_MAGIC		0x48544c50	/* "PLTH" */
+#define HANDOFF_VERSION		1
+
+struct handoff_msg {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t index;		/* of this message, starting at 0 */
+	uint32_t count;		/* messages in this handoff */
+	uint32_t conn_id;
+	uint32_t crtc_id;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t format;	/* DRM fourcc */
+	uint64_t modifier;	/* DRM_FORMAT_MOD_LINEAR, dumb buffers */
+	int32_t x;		/* plane position on the CRTC */
+	int32_t y;
+};
+
+struct handoff_ack {
+	uint32_t magic;
+};
+
+#endif /* __HANDOFF_H__ */
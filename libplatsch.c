@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -33,6 +34,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <fcntl.h>
 
 #include <xf86drm.h>
@@ -44,8 +49,14 @@
 static const struct platsch_format platsch_formats[] = {
 	{ DRM_FORMAT_RGB565, 16, "RGB565" }, /* default */
 	{ DRM_FORMAT_XRGB8888, 32, "XRGB8888" },
+	{ DRM_FORMAT_XBGR8888, 32, "XBGR8888" },
+	{ DRM_FORMAT_BGR888, 24, "BGR888" },
+	{ DRM_FORMAT_XRGB2101010, 32, "XRGB2101010" },
 };
 
+/* images in this format are converted for connectors using any other */
+static const struct platsch_format *master_format = &platsch_formats[1];
+
 
 ssize_t readfull(int fd, void *buf, size_t count)
 {
@@ -67,54 +78,94 @@ ssize_t readfull(int fd, void *buf, size_t count)
 	return ret;
 }
 
+/* raw image loaders for the non-cairo path, in order of preference */
+static const struct raw_loader {
+	const char *ext;
+	int (*load)(struct modeset_dev *dev, void *dst, const char *filename,
+		    const struct platsch_format *format);
+} raw_loaders[] = {
+	{ "rle", rle_file },
+	{ "bin", blit_file },
+};
+
 static int draw_buffer(struct modeset_dev *dev, const char *dir, const char *base)
 {
-	int fd_src;
+	struct modeset_buf *buf = &dev->bufs[dev->back_buf];
+	const struct platsch_format *formats[2];
 	char filename[128];
-	ssize_t size;
-	int ret;
+	uint64_t start;
+	int ret, err = -ENOENT, i, f;
 
 	/* Try cairo draw first and fall back in case of failure. */
 	ret = cairo_draw_buffer(dev, dir, base);
 	if (ret == 0)
 		return ret;
 
+	/* a bundle replaces all the per-file lookups below */
+	start = trace_now();
+	ret = bundle_draw(dev, buf->map, dir, base);
+	if (ret != -ENOENT) {
+		trace_phase(TRACE_DECODE, dev->conn_id, start);
+		return ret;
+	}
+
 	/*
 	 * make it easy and load a raw file in the right format instead of
 	 * opening an (say) PNG and convert the image data to the right format.
+	 * If there is none, an XRGB8888 image is converted while copying.
 	 */
-	ret = snprintf(filename, sizeof(filename),
-		       "%s/%s-%ux%u-%s.bin",
-		       dir, base, dev->width, dev->height, dev->format->name);
-	if (ret >= sizeof(filename)) {
-		error("Failed to fit filename into buffer\n");
-		return -EINVAL;
-	}
+	formats[0] = dev->format;
+	formats[1] = master_format;
 
-	fd_src = open(filename, O_RDONLY | O_CLOEXEC);
-	if (fd_src < 0) {
-		error("Failed to open %s: %m\n", filename);
-		return -ENOENT;
+	for (f = 0; f < ARRAY_SIZE(formats); f++) {
+		if (f && formats[f] == dev->format)
+			break;
+
+		for (i = 0; i < ARRAY_SIZE(raw_loaders); i++) {
+			ret = snprintf(filename, sizeof(filename),
+				       "%s/%s-%ux%u-%s.%s",
+				       dir, base, dev->width, dev->height,
+				       formats[f]->name, raw_loaders[i].ext);
+			if (ret >= sizeof(filename)) {
+				error("Failed to fit filename into buffer\n");
+				return -EINVAL;
+			}
+
+			if (access(filename, R_OK))
+				continue;
+
+			trace_phase(TRACE_DETECT, dev->conn_id, start);
+			start = trace_now();
+			/* a broken .rle shouldn't hide a usable .bin */
+			err = raw_loaders[i].load(dev, buf->map, filename,
+						  formats[f]);
+			trace_phase(TRACE_DECODE, dev->conn_id, start);
+			if (!err)
+				return 0;
+			start = trace_now();
+		}
 	}
 
-	size = readfull(fd_src, dev->map, dev->size);
-	if (size < dev->size) {
-		if (size < 0)
-			error("Failed to read from %s: %m\n", filename);
-		else
-			error("Could only read %zd/%u bytes from %s\n",
-			      size, dev->size, filename);
-		return -EIO;
+	/* QOI images are always 8 bit RGB(A) and converted while decoding */
+	ret = snprintf(filename, sizeof(filename), "%s/%s-%ux%u.qoi",
+		       dir, base, dev->width, dev->height);
+	if (ret >= sizeof(filename)) {
+		error("Failed to fit filename into buffer\n");
+		return -EINVAL;
 	}
 
-	ret = close(fd_src);
-	if (ret < 0) {
-		/* Nothing we can do about this, so just warn */
-		error("Failed to close image file\n");
-		return -EIO;
+	if (!access(filename, R_OK)) {
+		trace_phase(TRACE_DETECT, dev->conn_id, start);
+		start = trace_now();
+		ret = qoi_file(dev, buf->map, filename, master_format);
+		trace_phase(TRACE_DECODE, dev->conn_id, start);
+		return ret;
 	}
 
-	return 0;
+	if (err == -ENOENT)
+		error("No image found for %ux%u-%s\n", dev->width, dev->height,
+		      dev->format->name);
+	return err;
 }
 
 static struct modeset_dev *modeset_list = NULL;
@@ -217,10 +268,27 @@ static int drmprepare_crtc(int fd, drmModeRes *res, drmModeConnector *conn,
 	return -ENOENT;
 }
 
-static int modeset_create_fb(int fd, struct modeset_dev *dev)
+static void modeset_destroy_buf(int fd, struct modeset_dev *dev,
+			       struct modeset_buf *buf)
 {
-	struct drm_mode_create_dumb creq;
 	struct drm_mode_destroy_dumb dreq;
+
+	if (buf->map)
+		munmap(buf->map, dev->size);
+	if (buf->fb_id)
+		drmModeRmFB(fd, buf->fb_id);
+	if (buf->handle) {
+		memset(&dreq, 0, sizeof(dreq));
+		dreq.handle = buf->handle;
+		drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	}
+	memset(buf, 0, sizeof(*buf));
+}
+
+static int modeset_create_buf(int fd, struct modeset_dev *dev,
+			      struct modeset_buf *buf)
+{
+	struct drm_mode_create_dumb creq;
 	struct drm_mode_map_dumb mreq;
 	int ret;
 
@@ -236,15 +304,15 @@ static int modeset_create_fb(int fd, struct modeset_dev *dev)
 	}
 	dev->stride = creq.pitch;
 	dev->size = creq.size;
-	dev->handle = creq.handle;
+	buf->handle = creq.handle;
 
 	/* create framebuffer object for the dumb-buffer */
 	ret = drmModeAddFB2(fd, dev->width, dev->height,
 			    dev->format->format,
-			    (uint32_t[4]){ dev->handle, },
+			    (uint32_t[4]){ buf->handle, },
 			    (uint32_t[4]){ dev->stride, },
 			    (uint32_t[4]){ 0, },
-			    &dev->fb_id, 0);
+			    &buf->fb_id, 0);
 	if (ret) {
 		ret = -errno;
 		error("Cannot create framebuffer: %m\n");
@@ -253,40 +321,279 @@ static int modeset_create_fb(int fd, struct modeset_dev *dev)
 
 	/* prepare buffer for memory mapping */
 	memset(&mreq, 0, sizeof(mreq));
-	mreq.handle = dev->handle;
+	mreq.handle = buf->handle;
 	ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
 	if (ret) {
 		ret = -errno;
 		error("Cannot get mmap offset: %m\n");
-		goto err_fb;
+		goto err_destroy;
 	}
 
 	/* perform actual memory mapping */
-	dev->map = mmap(0, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	buf->map = mmap(0, dev->size, PROT_READ | PROT_WRITE, MAP_SHARED,
 			fd, mreq.offset);
-	if (dev->map == MAP_FAILED) {
+	if (buf->map == MAP_FAILED) {
 		ret = -errno;
+		buf->map = NULL;
 		error("Cannot mmap dumb buffer: %m\n");
-		goto err_fb;
+		goto err_destroy;
 	}
 
 	/*
-	 * Clear the framebuffer. Normally it's overwritten later with some
-	 * image data, but in case this fails, initialize to all-black.
+	 * The buffer isn't cleared here, whoever draws into it writes every
+	 * pixel, see draw(). That saves a full pass over write-combined memory.
 	 */
-	memset(dev->map, 0x0, dev->size);
 
 	return 0;
 
-err_fb:
-	drmModeRmFB(fd, dev->fb_id);
 err_destroy:
-	memset(&dreq, 0, sizeof(dreq));
-	dreq.handle = dev->handle;
-	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	modeset_destroy_buf(fd, dev, buf);
+	return ret;
+}
+
+/*
+ * Create the swapchain of a connector. With a single buffer the application
+ * renders into the scanout buffer directly, with two or more buffers
+ * get_back_buffer() never hands out the buffer that is currently displayed.
+ */
+static int modeset_create_fb(int fd, struct modeset_dev *dev)
+{
+	uint64_t start = trace_now();
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < dev->num_bufs; i++) {
+		ret = modeset_create_buf(fd, dev, &dev->bufs[i]);
+		if (ret) {
+			while (i--)
+				modeset_destroy_buf(fd, dev, &dev->bufs[i]);
+			return ret;
+		}
+	}
+	trace_phase(TRACE_FB, dev->conn_id, start);
+
+	dev->front_buf = -1;
+	dev->back_buf = 0;
+	dev->pending_buf = -1;
+
+	return 0;
+}
+
+static bool atomic;
+
+struct prop_lookup {
+	const char *name;
+	uint32_t *id;
+	bool optional;
+};
+
+/* Look up the IDs of all named properties of a KMS object */
+static int lookup_props(int fd, uint32_t obj_id, uint32_t obj_type,
+			const struct prop_lookup *lookup, unsigned int count)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	unsigned int i, j;
+
+	props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+	if (!props) {
+		error("Cannot get properties of object #%u: %m\n", obj_id);
+		return -errno;
+	}
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		for (j = 0; j < count; j++) {
+			if (!strcmp(prop->name, lookup[j].name))
+				*lookup[j].id = prop->prop_id;
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	for (j = 0; j < count; j++) {
+		if (!*lookup[j].id && !lookup[j].optional) {
+			error("Object #%u has no property %s\n", obj_id,
+			      lookup[j].name);
+			return -ENOENT;
+		}
+	}
+
+	return 0;
+}
+
+static int get_plane_type(int fd, uint32_t plane_id, uint64_t *type)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	unsigned int i;
+	int ret = -ENOENT;
+
+	props = drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return -errno;
+
+	for (i = 0; i < props->count_props && ret; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, "type")) {
+			*type = props->prop_values[i];
+			ret = 0;
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return ret;
+}
+
+static bool plane_in_use(uint32_t plane_id)
+{
+	struct modeset_dev *iter;
+
+	for (iter = modeset_list; iter; iter = iter->next) {
+		if (iter->plane_id == plane_id)
+			return true;
+		if (iter->sprite && iter->sprite->plane_id == plane_id)
+			return true;
+	}
+
+	return false;
+}
+
+static bool plane_supports_format(drmModePlane *plane, uint32_t format)
+{
+	unsigned int i;
+
+	for (i = 0; i < plane->count_formats; i++)
+		if (plane->formats[i] == format)
+			return true;
+
+	return false;
+}
+
+/*
+ * Find an unused plane of the given type that can be attached to dev's CRTC
+ * and scan out the given format.
+ */
+static int find_plane(int fd, drmModeRes *res, struct modeset_dev *dev,
+		      uint64_t type, uint32_t format, uint32_t *plane_id)
+{
+	drmModePlaneRes *planes;
+	drmModePlane *plane;
+	unsigned int i;
+	uint64_t plane_type = 0;
+	int crtc_index;
+	int ret = -ENOENT;
+
+	for (crtc_index = 0; crtc_index < res->count_crtcs; crtc_index++)
+		if (res->crtcs[crtc_index] == dev->crtc_id)
+			break;
+
+	if (crtc_index == res->count_crtcs)
+		return -ENOENT;
+
+	planes = drmModeGetPlaneResources(fd);
+	if (!planes) {
+		error("Cannot retrieve plane resources: %m\n");
+		return -errno;
+	}
+
+	for (i = 0; i < planes->count_planes && ret; i++) {
+		plane = drmModeGetPlane(fd, planes->planes[i]);
+		if (!plane)
+			continue;
+
+		if ((plane->possible_crtcs & (1 << crtc_index)) &&
+		    plane_supports_format(plane, format) &&
+		    !get_plane_type(fd, plane->plane_id, &plane_type) &&
+		    plane_type == type && !plane_in_use(plane->plane_id)) {
+			*plane_id = plane->plane_id;
+			ret = 0;
+		}
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(planes);
+
 	return ret;
 }
 
+static int lookup_plane_props(int fd, struct modeset_dev *dev)
+{
+	struct modeset_props *p = &dev->props;
+	const struct prop_lookup plane_props[] = {
+		{ "FB_ID", &p->plane_fb_id },
+		{ "CRTC_ID", &p->plane_crtc_id },
+		{ "SRC_X", &p->plane_src_x },
+		{ "SRC_Y", &p->plane_src_y },
+		{ "SRC_W", &p->plane_src_w },
+		{ "SRC_H", &p->plane_src_h },
+		{ "CRTC_X", &p->plane_crtc_x },
+		{ "CRTC_Y", &p->plane_crtc_y },
+		{ "CRTC_W", &p->plane_crtc_w },
+		{ "CRTC_H", &p->plane_crtc_h },
+		{ "FB_DAMAGE_CLIPS", &p->plane_damage_clips, true },
+	};
+
+	return lookup_props(fd, dev->plane_id, DRM_MODE_OBJECT_PLANE,
+			    plane_props, ARRAY_SIZE(plane_props));
+}
+
+static int atomic_prepare(int fd, drmModeRes *res, struct modeset_dev *dev)
+{
+	struct modeset_props *p = &dev->props;
+	const struct prop_lookup conn_props[] = {
+		{ "CRTC_ID", &p->conn_crtc_id },
+	};
+	const struct prop_lookup crtc_props[] = {
+		{ "MODE_ID", &p->crtc_mode_id },
+		{ "ACTIVE", &p->crtc_active },
+	};
+	int ret;
+
+	ret = find_plane(fd, res, dev, DRM_PLANE_TYPE_PRIMARY,
+			 dev->format->format, &dev->plane_id);
+	if (ret) {
+		error("No primary plane for crtc #%u\n", dev->crtc_id);
+		return ret;
+	}
+	debug("crtc #%u uses primary plane #%u\n", dev->crtc_id, dev->plane_id);
+
+	ret = lookup_props(fd, dev->conn_id, DRM_MODE_OBJECT_CONNECTOR,
+			   conn_props, ARRAY_SIZE(conn_props));
+	if (ret)
+		return ret;
+
+	ret = lookup_props(fd, dev->crtc_id, DRM_MODE_OBJECT_CRTC,
+			   crtc_props, ARRAY_SIZE(crtc_props));
+	if (ret)
+		return ret;
+
+	ret = lookup_plane_props(fd, dev);
+	if (ret)
+		return ret;
+
+	ret = drmModeCreatePropertyBlob(fd, &dev->mode, sizeof(dev->mode),
+					&dev->mode_blob);
+	if (ret) {
+		error("Cannot create mode blob: %m\n");
+		return -errno;
+	}
+
+	/*
+	 * Always commit the full state for the first frame, the kernel skips
+	 * the modeset if the CRTC already runs this mode.
+	 */
+	dev->setmode = 1;
+
+	return 0;
+}
+
 /* Returns lowercase connector type names with '_' for '-' */
 static char *get_normalized_conn_type_name(uint32_t connector_type)
 {
@@ -309,7 +616,7 @@ static char *get_normalized_conn_type_name(uint32_t connector_type)
 	return normalized_name;
 }
 
-static const struct platsch_format *platsch_format_find(const char *name)
+const struct platsch_format *platsch_format_find(const char *name)
 {
 	int i;
 
@@ -320,33 +627,67 @@ static const struct platsch_format *platsch_format_find(const char *name)
 	return NULL;
 }
 
-static int set_env_connector_mode(drmModeConnector *conn,
-				  struct modeset_dev *dev)
+const struct platsch_format *platsch_format_get(uint32_t format)
 {
-	int ret, i = 0;
-	u_int32_t width = 0, height = 0;
-	const char *mode;
-	char *connector_type_name, mode_env_name[32], fmt_specifier[32] = "";
-	const struct platsch_format *format = NULL;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(platsch_formats); i++)
+		if (platsch_formats[i].format == format)
+			return &platsch_formats[i];
+
+	return NULL;
+}
+
+/*
+ * Look up the platsch_<type><id>_mode environment variable of a connector.
+ * *mode is NULL if it isn't set, -ENOENT means the type has no name.
+ */
+static int getenv_connector_mode(drmModeConnector *conn, char *mode_env_name,
+				 size_t mode_env_name_sz, const char **mode)
+{
+	char *connector_type_name;
+	int ret;
+
+	*mode = NULL;
 
 	connector_type_name = get_normalized_conn_type_name(conn->connector_type);
 	if (!connector_type_name) {
 		error("could not look up name for connector type %u\n",
 		      conn->connector_type);
-		goto fallback;
+		return -ENOENT;
 	}
 
-	ret = snprintf(mode_env_name, sizeof(mode_env_name), "platsch_%s%u_mode",
+	ret = snprintf(mode_env_name, mode_env_name_sz, "platsch_%s%u_mode",
 		       connector_type_name, conn->connector_type_id);
 	free(connector_type_name);
-	if (ret >= sizeof(mode_env_name)) {
+	if (ret >= mode_env_name_sz) {
 		error("failed to fit platsch env mode variable name into buffer\n");
 		return -EFAULT;
 	}
 
 	/* check for connector mode configuration in environment */
 	debug("looking up %s env variable\n", mode_env_name);
-	mode = getenv(mode_env_name);
+	*mode = getenv(mode_env_name);
+
+	return 0;
+}
+
+static int set_env_connector_mode(drmModeConnector *conn,
+				  struct modeset_dev *dev)
+{
+	int ret, i = 0;
+	u_int32_t width = 0, height = 0;
+	const char *mode;
+	char mode_env_name[32], fmt_specifier[32] = "";
+	const struct platsch_format *format = NULL;
+
+	ret = getenv_connector_mode(conn, mode_env_name, sizeof(mode_env_name),
+				    &mode);
+	if (ret == -ENOENT)
+		goto fallback;
+	else if (ret)
+		return ret;
+
 	if (!mode)
 		goto fallback;
 
@@ -398,11 +739,48 @@ fallback_format:
 	return 0;
 }
 
+static pthread_mutex_t modeset_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void modeset_list_remove(struct modeset_dev *dev)
+{
+	struct modeset_dev **iter;
+
+	pthread_mutex_lock(&modeset_lock);
+	for (iter = &modeset_list; *iter; iter = &(*iter)->next) {
+		if (*iter == dev) {
+			*iter = dev->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&modeset_lock);
+}
+
+static bool crtc_in_use(uint32_t crtc_id)
+{
+	struct modeset_dev *iter;
+
+	for (iter = modeset_list; iter; iter = iter->next)
+		if (iter->crtc_id == crtc_id)
+			return true;
+
+	return false;
+}
+
+/*
+ * Set up dev for the connector. If cached is set, mode, format and CRTC were
+ * already filled in from the modeset cache and only need to be claimed.
+ */
 static int drmprepare_connector(int fd, drmModeRes *res, drmModeConnector *conn,
-				struct modeset_dev *dev)
+				struct modeset_dev *dev, bool cached)
 {
 	int ret;
 
+	dev->conn_type = conn->connector_type;
+	dev->conn_type_id = conn->connector_type_id;
+
+	if (cached)
+		goto claim;
+
 	/* check if a monitor is connected */
 	if (conn->connection != DRM_MODE_CONNECTED) {
 		error("Ignoring unused connector #%u\n", conn->connector_id);
@@ -424,131 +802,727 @@ static int drmprepare_connector(int fd, drmModeRes *res, drmModeConnector *conn,
 	debug("mode for connector #%u is %ux%u@%s\n",
 	      conn->connector_id, dev->width, dev->height, dev->format->name);
 
+claim:
+	/*
+	 * Finding a crtc and planes is the only step that has to be serialized
+	 * between connectors. Link the device into the list right away, so no
+	 * other connector picks the same ones.
+	 */
+	pthread_mutex_lock(&modeset_lock);
+
 	/* find a crtc for this connector */
-	ret = drmprepare_crtc(fd, res, conn, dev);
+	if (cached)
+		ret = crtc_in_use(dev->crtc_id) ? -EBUSY : 0;
+	else
+		ret = drmprepare_crtc(fd, res, conn, dev);
 	if (ret) {
+		pthread_mutex_unlock(&modeset_lock);
 		error("no valid crtc for connector #%u\n", conn->connector_id);
 		return ret;
 	}
 
+	/* a single connector without atomic support disables it for all */
+	if (atomic && atomic_prepare(fd, res, dev)) {
+		error("falling back to legacy modesetting\n");
+		atomic = false;
+	}
+
+	dev->next = modeset_list;
+	modeset_list = dev;
+
+	pthread_mutex_unlock(&modeset_lock);
+
 	/* create a framebuffer for this CRTC */
 	ret = modeset_create_fb(fd, dev);
 	if (ret) {
 		error("cannot create framebuffer for connector #%u\n",
 		      conn->connector_id);
+		modeset_list_remove(dev);
+		if (dev->mode_blob)
+			drmModeDestroyPropertyBlob(fd, dev->mode_blob);
+		dev->mode_blob = 0;
 		return ret;
 	}
 
 	return 0;
 }
 
-static int drmprepare(int fd)
-{
-	drmModeRes *res;
-	drmModeConnector *conn;
-	unsigned int i;
-	struct modeset_dev *dev;
-	int ret;
+/*
+ * Modeset cache
+ *
+ * Probing a connector with drmModeGetConnector() reads the EDID over DDC/AUX,
+ * which takes tens to hundreds of milliseconds. If platsch_modeset_cache
+ * names a file, the connector -> CRTC/mode/format decisions are stored there
+ * and reused on the next boot after a cheap check with
+ * drmModeGetConnectorCurrent(). That only reports the modes of connectors the
+ * kernel probed itself before, e.g. for fbdev emulation. Connectors that were
+ * probed but found unused are stored as skip entries and aren't probed again
+ * unless the kernel reports them connected. Connectors whose state differs
+ * from the cache are probed as usual. The cache is only rewritten if any
+ * decision changed.
+ */
 
-	/* retrieve resources */
-	res = drmModeGetResources(fd);
-	if (!res) {
-		error("cannot retrieve DRM resources: %m\n");
-		return -errno;
-	}
+#define MODESET_CACHE_VERSION 1
+
+struct cache_entry {
+	uint32_t conn_id;
+	uint32_t conn_type;
+	uint32_t conn_type_id;
+	bool skip;
+	uint32_t crtc_id;
+	char format[16];
+	char mode_env[64];
+	drmModeModeInfo mode;
+};
 
-	debug("Found %d connectors\n", res->count_connectors);
+static char drm_device_path[128];
+static struct cache_entry *cache_entries;
+static unsigned int cache_count;
 
-	/* iterate all connectors */
-	for (i = 0; i < res->count_connectors; ++i) {
-		/* get information for each connector */
-		conn = drmModeGetConnector(fd, res->connectors[i]);
-		if (!conn) {
-			error("Cannot retrieve DRM connector #%u: %m\n",
-				res->connectors[i]);
-			continue;
-		}
-		assert(conn->connector_id == res->connectors[i]);
+static int modeset_cache_load(const char *path)
+{
+	struct cache_entry e, *entries;
+	drmModeModeInfo *m = &e.mode;
+	char line[512], device[128];
+	int version, n, ret = 0;
+	FILE *f;
+
+	f = fopen(path, "re");
+	if (!f)
+		return -errno;
 
-		debug("Connector #%u has type %s\n", conn->connector_id,
-		      drmModeGetConnectorTypeName(conn->connector_type));
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "platsch-modeset-cache %d %127s", &version, device) != 2 ||
+	    version != MODESET_CACHE_VERSION || strcmp(device, drm_device_path)) {
+		ret = -ESTALE;
+		goto out;
+	}
 
-		/* create a device structure */
-		dev = malloc(sizeof(*dev));
-		if (!dev) {
-			error("Cannot allocate memory for connector #%u: %m\n",
-			      res->connectors[i]);
-			continue;
+	while (fgets(line, sizeof(line), f)) {
+		memset(&e, 0, sizeof(e));
+		n = 0;
+		sscanf(line, "%u %u %u skip%n", &e.conn_id, &e.conn_type,
+		       &e.conn_type_id, &n);
+		if (n) {
+			e.skip = true;
+		} else if (sscanf(line, "%u %u %u %u %15s %63s "
+			   "%u %hu %hu %hu %hu %hu %hu %hu %hu %hu %hu %u %u %u %31s",
+			   &e.conn_id, &e.conn_type, &e.conn_type_id, &e.crtc_id,
+			   e.format, e.mode_env,
+			   &m->clock, &m->hdisplay, &m->hsync_start, &m->hsync_end,
+			   &m->htotal, &m->hskew, &m->vdisplay, &m->vsync_start,
+			   &m->vsync_end, &m->vtotal, &m->vscan, &m->vrefresh,
+			   &m->flags, &m->type, m->name) != 21) {
+			ret = -ESTALE;
+			goto out;
+		} else if (!strcmp(m->name, "-")) {
+			memset(m->name, 0, sizeof(m->name));
 		}
-		memset(dev, 0, sizeof(*dev));
-		dev->conn_id = conn->connector_id;
 
-		ret = drmprepare_connector(fd, res, conn, dev);
-		if (ret) {
-			if (ret != -ENOENT) {
-				error("Cannot setup device for connector #%u: %m\n",
-				      res->connectors[i]);
-			}
-			free(dev);
-			drmModeFreeConnector(conn);
-			continue;
+		entries = realloc(cache_entries, (cache_count + 1) * sizeof(e));
+		if (!entries) {
+			ret = -ENOMEM;
+			goto out;
 		}
-
-		/* free connector data and link device into global list */
-		drmModeFreeConnector(conn);
-		dev->next = modeset_list;
-		modeset_list = dev;
+		cache_entries = entries;
+		cache_entries[cache_count++] = e;
 	}
 
-	/* free resources again */
-	drmModeFreeResources(res);
-	return 0;
+out:
+	fclose(f);
+	if (ret) {
+		free(cache_entries);
+		cache_entries = NULL;
+		cache_count = 0;
+	}
+	return ret;
 }
 
-
-static int drmfd;
-
-struct modeset_dev *init(void) 
+static const struct cache_entry *modeset_cache_find(uint32_t conn_id)
 {
-	static char drmdev[128];
-	int ret = 0, i;
+	unsigned int i;
 
-	for (i = 0; i < 64; i++) {
-		struct drm_mode_card_res res = {0};
+	for (i = 0; i < cache_count; i++)
+		if (cache_entries[i].conn_id == conn_id)
+			return &cache_entries[i];
 
-		/*
-		 * XXX: Maybe use drmOpen instead?
-		 * (Where should name/busid come from?)
-		 * XXX: Loop through drm devices to find one with connectors.
-		 */
-		ret = snprintf(drmdev, sizeof(drmdev), DRM_DEV_NAME, DRM_DIR_NAME, i);
-		if (ret >= sizeof(drmdev)) {
-			error("Huh, device name overflowed buffer\n");
-			goto execinit;
+	return NULL;
+}
+
+/*
+ * Set up dev from a cache entry if the connector still looks the same
+ * without probing it. Returns -ESTALE if it doesn't.
+ */
+static int drmprepare_cached(int fd, drmModeRes *res, const struct cache_entry *e,
+			     struct modeset_dev *dev)
+{
+	drmModeConnector *conn;
+	drmModeEncoder *enc;
+	const char *mode_env;
+	char mode_env_name[32];
+	int i, ret = -ESTALE;
+
+	/* reports what the kernel already knows, no EDID read */
+	conn = drmModeGetConnectorCurrent(fd, e->conn_id);
+	if (!conn)
+		return -ESTALE;
+
+	if (conn->connection != DRM_MODE_CONNECTED ||
+	    conn->connector_type != e->conn_type ||
+	    conn->connector_type_id != e->conn_type_id)
+		goto out;
+
+	/* the requested mode may have changed on the kernel commandline */
+	if (getenv_connector_mode(conn, mode_env_name, sizeof(mode_env_name),
+				  &mode_env) ||
+	    strcmp(mode_env ? mode_env : "-", e->mode_env))
+		goto out;
+
+	for (i = 0; i < conn->count_modes; i++)
+		if (!memcmp(&conn->modes[i], &e->mode, sizeof(e->mode)))
+			break;
+	if (i == conn->count_modes)
+		goto out;
+
+	for (i = 0; i < res->count_crtcs; i++)
+		if (res->crtcs[i] == e->crtc_id)
+			break;
+	if (i == res->count_crtcs)
+		goto out;
+
+	dev->format = platsch_format_find(e->format);
+	if (!dev->format)
+		goto out;
+
+	memcpy(&dev->mode, &e->mode, sizeof(dev->mode));
+	dev->width = e->mode.hdisplay;
+	dev->height = e->mode.vdisplay;
+	dev->crtc_id = e->crtc_id;
+
+	/* no modeset needed if the connector already runs on this crtc */
+	dev->setmode = 1;
+	if (conn->encoder_id) {
+		enc = drmModeGetEncoder(fd, conn->encoder_id);
+		if (enc) {
+			dev->setmode = enc->crtc_id != e->crtc_id;
+			drmModeFreeEncoder(enc);
+		}
+	}
+
+	debug("using cached %ux%u@%s on crtc #%u for connector #%u\n",
+	      dev->width, dev->height, dev->format->name, dev->crtc_id,
+	      dev->conn_id);
+
+	ret = drmprepare_connector(fd, res, conn, dev, true);
+	if (ret == -EBUSY)
+		ret = -ESTALE;
+
+out:
+	drmModeFreeConnector(conn);
+	return ret;
+}
+
+static unsigned int num_buffers = 1;
+
+struct connector_job {
+	pthread_t thread;
+	bool started;
+	int fd;
+	drmModeRes *res;
+	uint32_t conn_id;
+	const char *dir;
+	const char *base;
+	bool use_cache;
+	const struct cache_entry *cached;
+	struct modeset_dev *dev;	/* set up for this connector */
+	bool skip;			/* found unused */
+	uint32_t skip_type;
+	uint32_t skip_type_id;
+	bool pipeline;
+};
+
+static void modeset_cache_print(FILE *f, const struct connector_job *job)
+{
+	const struct modeset_dev *dev = job->dev;
+	const drmModeModeInfo *m;
+	const char *mode_env;
+	char mode_env_name[32];
+	drmModeConnector conn;
+
+	if (job->skip) {
+		fprintf(f, "%u %u %u skip\n", job->conn_id, job->skip_type,
+			job->skip_type_id);
+		return;
+	}
+
+	if (!dev)
+		return;
+
+	conn.connector_type = dev->conn_type;
+	conn.connector_type_id = dev->conn_type_id;
+	if (getenv_connector_mode(&conn, mode_env_name, sizeof(mode_env_name),
+				  &mode_env))
+		mode_env = NULL;
+
+	m = &dev->mode;
+	fprintf(f, "%u %u %u %u %s %s "
+		"%u %hu %hu %hu %hu %hu %hu %hu %hu %hu %hu %u %u %u %s\n",
+		dev->conn_id, dev->conn_type, dev->conn_type_id,
+		dev->crtc_id, dev->format->name,
+		mode_env ? mode_env : "-",
+		m->clock, m->hdisplay, m->hsync_start, m->hsync_end,
+		m->htotal, m->hskew, m->vdisplay, m->vsync_start,
+		m->vsync_end, m->vtotal, m->vscan, m->vrefresh,
+		m->flags, m->type, m->name[0] ? m->name : "-");
+}
+
+/*
+ * Write the decisions for all connectors, in connector order so an unchanged
+ * setup results in the same file, which is then left alone.
+ */
+static void modeset_cache_store(const char *path, struct connector_job *jobs,
+				unsigned int count)
+{
+	char tmp[PATH_MAX], *buf = NULL, *old = NULL;
+	size_t len, old_len = 0;
+	unsigned int i;
+	FILE *f;
+	int ret;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return;
+
+	fprintf(f, "platsch-modeset-cache %d %s\n", MODESET_CACHE_VERSION,
+		drm_device_path);
+	for (i = 0; i < count; i++)
+		modeset_cache_print(f, &jobs[i]);
+	if (fclose(f))
+		goto out;
+
+	f = fopen(path, "re");
+	if (f) {
+		old = malloc(len + 1);
+		if (old)
+			old_len = fread(old, 1, len + 1, f);
+		fclose(f);
+		if (old_len == len && !memcmp(old, buf, len)) {
+			debug("modeset cache %s is up to date\n", path);
+			goto out;
+		}
+	}
+
+	ret = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (ret >= sizeof(tmp))
+		goto out;
+
+	f = fopen(tmp, "we");
+	if (!f) {
+		error("Failed to write modeset cache %s: %m\n", tmp);
+		goto out;
+	}
+
+	if (fwrite(buf, 1, len, f) != len || fflush(f) || fsync(fileno(f))) {
+		error("Failed to write modeset cache %s: %m\n", tmp);
+		fclose(f);
+		unlink(tmp);
+		goto out;
+	}
+	fclose(f);
+
+	if (rename(tmp, path)) {
+		error("Failed to replace modeset cache %s: %m\n", path);
+		unlink(tmp);
+	}
+
+out:
+	free(old);
+	free(buf);
+}
+
+/* A skip entry holds as long as the kernel doesn't know better */
+static bool connector_still_unused(int fd, const struct cache_entry *e)
+{
+	drmModeConnector *conn;
+	bool unused;
+
+	conn = drmModeGetConnectorCurrent(fd, e->conn_id);
+	if (!conn)
+		return false;
+
+	unused = conn->connection != DRM_MODE_CONNECTED &&
+		 conn->connector_type == e->conn_type &&
+		 conn->connector_type_id == e->conn_type_id;
+	drmModeFreeConnector(conn);
+
+	return unused;
+}
+
+static int atomic_blank(struct modeset_dev *dev);
+
+/*
+ * Probe a single connector, set up its device and, if an image directory is
+ * given, draw the splash into it. In legacy mode the mode is set right away,
+ * atomic modesets are committed for all connectors at once afterwards. Unless
+ * platsch_pipeline=0, an atomic connector's mode is set with a black screen
+ * before drawing instead, so link training overlaps loading the image, and
+ * the splash follows with a flip.
+ */
+static void *drmprepare_worker(void *arg)
+{
+	struct connector_job *job = arg;
+	uint64_t start = trace_now();
+	drmModeConnector *conn;
+	struct modeset_dev *dev;
+	bool legacy;
+	int ret;
+
+	/* create a device structure */
+	dev = malloc(sizeof(*dev));
+	if (!dev) {
+		error("Cannot allocate memory for connector #%u: %m\n",
+		      job->conn_id);
+		return NULL;
+	}
+	memset(dev, 0, sizeof(*dev));
+	dev->conn_id = job->conn_id;
+	dev->num_bufs = num_buffers;
+
+	if (job->cached && job->cached->skip) {
+		if (connector_still_unused(job->fd, job->cached)) {
+			debug("skipping unused connector #%u\n", job->conn_id);
+			job->skip = true;
+			job->skip_type = job->cached->conn_type;
+			job->skip_type_id = job->cached->conn_type_id;
+			free(dev);
+			return NULL;
 		}
 
-		drmfd = open(drmdev, O_RDWR | O_CLOEXEC, 0);
-		if (drmfd < 0) {
-			error("Failed to open drm device: %m\n");
-			goto execinit;
+		debug("modeset cache is stale for connector #%u\n", job->conn_id);
+	} else if (job->cached) {
+		ret = drmprepare_cached(job->fd, job->res, job->cached, dev);
+		if (!ret) {
+			job->dev = dev;
+			goto draw;
 		}
 
-		ret = drmIoctl(drmfd, DRM_IOCTL_MODE_GETRESOURCES, &res);
-		if (ret < 0) {
-			close(drmfd);
+		debug("modeset cache is stale for connector #%u\n", job->conn_id);
+		if (dev->mode_blob)
+			drmModeDestroyPropertyBlob(job->fd, dev->mode_blob);
+		memset(dev, 0, sizeof(*dev));
+		dev->conn_id = job->conn_id;
+		dev->num_bufs = num_buffers;
+	} else if (job->use_cache) {
+		/*
+		 * Not in the cache, skip the probe only if it is known to be
+		 * disconnected. Unprobed connectors often report unknown.
+		 */
+		conn = drmModeGetConnectorCurrent(job->fd, job->conn_id);
+		if (conn && conn->connection == DRM_MODE_DISCONNECTED) {
+			job->skip = true;
+			job->skip_type = conn->connector_type;
+			job->skip_type_id = conn->connector_type_id;
+			drmModeFreeConnector(conn);
+			free(dev);
+			return NULL;
+		}
+		drmModeFreeConnector(conn);
+	}
+
+	/* get information for each connector */
+	conn = drmModeGetConnector(job->fd, job->conn_id);
+	if (!conn) {
+		error("Cannot retrieve DRM connector #%u: %m\n", job->conn_id);
+		free(dev);
+		return NULL;
+	}
+	assert(conn->connector_id == job->conn_id);
+
+	debug("Connector #%u has type %s\n", conn->connector_id,
+	      drmModeGetConnectorTypeName(conn->connector_type));
+
+	ret = drmprepare_connector(job->fd, job->res, conn, dev, false);
+	if (ret == -ENOENT) {
+		job->skip = true;
+		job->skip_type = conn->connector_type;
+		job->skip_type_id = conn->connector_type_id;
+	}
+	drmModeFreeConnector(conn);
+	if (ret) {
+		if (ret != -ENOENT) {
+			error("Cannot setup device for connector #%u: %m\n",
+			      job->conn_id);
+		}
+		free(dev);
+		return NULL;
+	}
+	job->dev = dev;
+
+draw:
+	trace_phase(TRACE_PREPARE, dev->conn_id, start);
+	if (!job->dir)
+		return NULL;
+
+	pthread_mutex_lock(&modeset_lock);
+	legacy = !atomic;
+	pthread_mutex_unlock(&modeset_lock);
+
+	if (!legacy && job->pipeline)
+		atomic_blank(dev);
+
+	draw(dev, job->dir, job->base);
+
+	if (legacy)
+		update_display(dev);
+
+	return NULL;
+}
+
+static int drmprepare(int fd, const char *dir, const char *base)
+{
+	struct connector_job *jobs;
+	drmModeRes *res;
+	unsigned int i;
+	const char *env, *cache_path;
+	bool parallel, pipeline, use_cache = false;
+	int ret;
+
+	/* retrieve resources */
+	res = drmModeGetResources(fd);
+	if (!res) {
+		error("cannot retrieve DRM resources: %m\n");
+		return -errno;
+	}
+
+	debug("Found %d connectors\n", res->count_connectors);
+
+	jobs = calloc(res->count_connectors, sizeof(*jobs));
+	if (!jobs) {
+		drmModeFreeResources(res);
+		return -ENOMEM;
+	}
+
+	/*
+	 * Handle each connector in its own thread, so a slow EDID read or image
+	 * load on one output doesn't delay the others.
+	 */
+	env = getenv("platsch_parallel");
+	parallel = !env || strcmp(env, "0");
+
+	env = getenv("platsch_pipeline");
+	pipeline = !env || strcmp(env, "0");
+
+	cache_path = getenv("platsch_modeset_cache");
+	if (cache_path) {
+		ret = modeset_cache_load(cache_path);
+		use_cache = !ret;
+		if (ret)
+			debug("not using modeset cache %s: %s\n", cache_path,
+			      strerror(-ret));
+	}
+
+	for (i = 0; i < res->count_connectors; ++i) {
+		jobs[i].fd = fd;
+		jobs[i].res = res;
+		jobs[i].conn_id = res->connectors[i];
+		jobs[i].dir = dir;
+		jobs[i].base = base;
+		jobs[i].use_cache = use_cache;
+		jobs[i].pipeline = pipeline;
+		if (use_cache)
+			jobs[i].cached = modeset_cache_find(res->connectors[i]);
+
+		if (parallel && !pthread_create(&jobs[i].thread, NULL,
+						drmprepare_worker, &jobs[i]))
+			jobs[i].started = true;
+		else
+			drmprepare_worker(&jobs[i]);
+	}
+
+	for (i = 0; i < res->count_connectors; ++i)
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+
+	if (cache_path)
+		modeset_cache_store(cache_path, jobs, res->count_connectors);
+
+	free(jobs);
+	free(cache_entries);
+	cache_entries = NULL;
+	cache_count = 0;
+
+	/* free resources again */
+	drmModeFreeResources(res);
+	return 0;
+}
+
+
+static int drmfd;
+
+#define DRM_MAX_CARDS 64
+#define SYSFS_DRM_DIR "/sys/class/drm"
+
+/* Open a DRM device node and make sure it supports modesetting */
+static int open_kms_device(const char *path)
+{
+	struct drm_mode_card_res res = {0};
+	int fd, ret;
+
+	fd = open(path, O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	ret = drmIoctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res);
+	if (ret < 0) {
+		close(fd);
+		return -ENODEV;
+	}
+
+	debug("using DRM device %s\n", path);
+	snprintf(drm_device_path, sizeof(drm_device_path), "%s", path);
+
+	return fd;
+}
+
+static bool sysfs_connector_connected(const char *name)
+{
+	char path[PATH_MAX], status[16] = "";
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), SYSFS_DRM_DIR "/%s/status", name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	len = read(fd, status, sizeof(status) - 1);
+	close(fd);
+
+	return len > 0 && !strncmp(status, "connected", 9);
+}
+
+/*
+ * Use sysfs to find the card to open instead of trying every node: connector
+ * entries (card<N>-<connector>) only exist for KMS devices, so render-only
+ * GPUs are skipped without opening them. Cards with a connected output are
+ * preferred. Returns the card number or -ENODEV.
+ */
+static int sysfs_find_card(void)
+{
+	bool has_connectors[DRM_MAX_CARDS] = { false };
+	bool connected[DRM_MAX_CARDS] = { false };
+	struct dirent *entry;
+	unsigned int card;
+	int n, first_kms = -ENODEV;
+	DIR *dir;
+
+	dir = opendir(SYSFS_DRM_DIR);
+	if (!dir)
+		return -ENODEV;
+
+	while ((entry = readdir(dir))) {
+		/* %n is only assigned if the '-' after the card number matches */
+		n = 0;
+		if (sscanf(entry->d_name, "card%u-%n", &card, &n) < 1 ||
+		    !n || card >= DRM_MAX_CARDS)
 			continue;
-		} else {
-			/* Device found */
-			break;
+
+		has_connectors[card] = true;
+		if (!connected[card] && sysfs_connector_connected(entry->d_name))
+			connected[card] = true;
+	}
+	closedir(dir);
+
+	for (card = 0; card < DRM_MAX_CARDS; card++) {
+		if (connected[card])
+			return card;
+		if (has_connectors[card] && first_kms < 0)
+			first_kms = card;
+	}
+
+	return first_kms;
+}
+
+static int open_drm_device(void)
+{
+	char drmdev[128];
+	const char *env;
+	int ret, fd, i;
+
+	/* platsch_drm_device=/dev/dri/card1 or platsch_drm_device=card1 */
+	env = getenv("platsch_drm_device");
+	if (env) {
+		if (strchr(env, '/'))
+			ret = snprintf(drmdev, sizeof(drmdev), "%s", env);
+		else
+			ret = snprintf(drmdev, sizeof(drmdev), "%s/%s", DRM_DIR_NAME, env);
+		if (ret >= sizeof(drmdev)) {
+			error("Huh, device name overflowed buffer\n");
+			return -EINVAL;
+		}
+
+		fd = open_kms_device(drmdev);
+		if (fd < 0)
+			error("Failed to open drm device %s: %s\n", drmdev,
+			      strerror(-fd));
+		return fd;
+	}
+
+	i = sysfs_find_card();
+	if (i >= 0) {
+		snprintf(drmdev, sizeof(drmdev), DRM_DEV_NAME, DRM_DIR_NAME, i);
+		fd = open_kms_device(drmdev);
+		if (fd >= 0)
+			return fd;
+	}
+
+	/* no sysfs, fall back to probing every node */
+	for (i = 0; i < DRM_MAX_CARDS; i++) {
+		ret = snprintf(drmdev, sizeof(drmdev), DRM_DEV_NAME, DRM_DIR_NAME, i);
+		if (ret >= sizeof(drmdev)) {
+			error("Huh, device name overflowed buffer\n");
+			return -EINVAL;
 		}
+
+		fd = open_kms_device(drmdev);
+		if (fd >= 0)
+			return fd;
+		if (fd == -ENOENT)
+			break;
 	}
 
-	if (i == 64) {
-		error("No suitable DRM device found\n");
+	error("No suitable DRM device found\n");
+	return -ENODEV;
+}
+
+static struct modeset_dev *modeset_init(unsigned int num_bufs, const char *dir,
+					const char *base)
+{
+	uint64_t start;
+	int ret = 0;
+
+	if (num_bufs < 1 || num_bufs > MODESET_MAX_BUFFERS) {
+		error("Invalid number of buffers %u, must be 1..%u\n",
+		      num_bufs, MODESET_MAX_BUFFERS);
 		goto execinit;
 	}
+	num_buffers = num_bufs;
+
+	start = trace_now();
+	drmfd = open_drm_device();
+	if (drmfd < 0)
+		goto execinit;
+	trace_phase(TRACE_DISCOVERY, 0, start);
 
-	ret = drmprepare(drmfd);
+	/* needed to find primary and cursor planes, legacy or not */
+	drmSetClientCap(drmfd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+	if (!getenv("platsch_legacy_kms") &&
+	    !drmSetClientCap(drmfd, DRM_CLIENT_CAP_ATOMIC, 1))
+		atomic = true;
+	debug("using %s modesetting\n", atomic ? "atomic" : "legacy");
+
+	ret = drmprepare(drmfd, dir, base);
 	if (ret) {
 		error("Failed to prepare DRM device\n");
 		goto execinit;
@@ -560,34 +1534,795 @@ execinit:
 	return NULL;
 }
 
+struct modeset_dev *init(unsigned int num_bufs)
+{
+	return modeset_init(num_bufs, NULL, NULL);
+}
+
+/* longest show_splash() holds DRM master waiting for a link to come up */
+#define SPLASH_TIMEOUT_MS 1000
+
+static bool splash_pending(void)
+{
+	struct modeset_dev *iter;
+
+	for (iter = modeset_list; iter; iter = iter->next)
+		if (iter->blanked)
+			return true;
+
+	return false;
+}
+
+/*
+ * Like init(), but also draw the splash image found in dir and show it on
+ * every connector. Probing, buffer allocation, image loading and legacy
+ * modesets happen concurrently per connector, as do blank atomic modesets.
+ * Those may still be training links on return, show_splash() then puts the
+ * splash on screen once they are done.
+ */
+struct modeset_dev *init_and_draw(unsigned int num_bufs, const char *dir,
+				  const char *base)
+{
+	struct modeset_dev *iter;
+
+	if (!modeset_init(num_bufs, dir, base))
+		return NULL;
+
+	if (atomic) {
+		if (splash_pending())
+			return modeset_list;
+		update_displays();
+	} else {
+		/* catch connectors that saw atomic before it was disabled */
+		for (iter = modeset_list; iter; iter = iter->next)
+			if (iter->blanked ||
+			    (iter->front_buf < 0 && iter->pending_buf < 0))
+				update_display(iter);
+	}
+	wait_displays();
+	trace_summary();
+
+	return modeset_list;
+}
+
+/*
+ * Wait for the blank modesets init_and_draw() left in flight and flip to the
+ * splash. Call it where waiting doesn't hold up booting, e.g. after forking
+ * off init, and before dropping DRM master. As a compositor started early
+ * can't become master before that, a link that doesn't come up within
+ * SPLASH_TIMEOUT_MS is given up on and stays black, returning -ETIMEDOUT.
+ */
+int show_splash(void)
+{
+	struct modeset_dev *iter;
+	uint64_t deadline = trace_now() + SPLASH_TIMEOUT_MS * 1000000ULL, now;
+	int ret;
+
+	if (!splash_pending())
+		return 0;
+
+	for (iter = modeset_list; iter; iter = iter->next) {
+		while (iter->blanked && iter->pending_buf >= 0) {
+			now = trace_now();
+			ret = now < deadline ?
+			      handle_display_events((deadline - now) / 1000000 + 1) :
+			      -ETIMEDOUT;
+			if (ret) {
+				error("Modeset on connector #%u didn't complete: %s\n",
+				      iter->conn_id, strerror(-ret));
+				return ret;
+			}
+		}
+	}
+
+	ret = update_displays();
+	wait_displays();
+	trace_summary();
+
+	return ret;
+}
+
+
+static void page_flip_handler(int fd, unsigned int sequence,
+			      unsigned int tv_sec, unsigned int tv_usec,
+			      unsigned int crtc_id, void *user_data)
+{
+	struct modeset_dev *dev = user_data;
+
+	/* atomic commits cover several CRTCs, so they carry no user data */
+	if (!dev) {
+		for (dev = modeset_list; dev; dev = dev->next)
+			if (dev->crtc_id == crtc_id)
+				break;
+		if (!dev)
+			return;
+	}
+
+	/* a blank modeset completed, nothing is scanned out yet */
+	if (dev->pending_buf >= 0 && !dev->blanked)
+		dev->front_buf = dev->pending_buf;
+	dev->pending_buf = -1;
+	if (dev->sprite && dev->sprite->pending_buf >= 0) {
+		dev->sprite->front_buf = dev->sprite->pending_buf;
+		dev->sprite->pending_buf = -1;
+	}
+	dev->flip_seq = sequence;
+	dev->flip_time.tv_sec = tv_sec;
+	dev->flip_time.tv_usec = tv_usec;
+
+	/* the event carries the CLOCK_MONOTONIC time of the vblank */
+	if (dev->modeset_time) {
+		trace_phase_end(TRACE_MODESET, dev->conn_id, dev->modeset_time,
+				tv_sec * 1000000000ULL + tv_usec * 1000ULL);
+		dev->modeset_time = 0;
+	} else if (dev->present_time && !dev->blanked) {
+		trace_phase_end(TRACE_PRESENT, dev->conn_id, dev->present_time,
+				tv_sec * 1000000000ULL + tv_usec * 1000ULL);
+		dev->present_time = 0;
+	}
+}
+
+/* For callers polling the DRM device along with other fds */
+int display_fd(void)
+{
+	return drmfd;
+}
+
+/*
+ * Wait up to timeout_ms (-1 for infinite) for DRM events and dispatch them.
+ * Returns -ETIMEDOUT if nothing arrived in time.
+ */
+int handle_display_events(int timeout_ms)
+{
+	drmEventContext evctx = {
+		.version = 3,
+		.page_flip_handler2 = page_flip_handler,
+	};
+	struct pollfd pfd = {
+		.fd = drmfd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		error("Failed to poll DRM device: %m\n");
+		return -errno;
+	} else if (ret == 0) {
+		return -ETIMEDOUT;
+	}
+
+	ret = drmHandleEvent(drmfd, &evctx);
+	if (ret) {
+		error("Failed to handle DRM events\n");
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int wait_page_flip(struct modeset_dev *dev)
+{
+	int ret;
+
+	while (dev->pending_buf >= 0 ||
+	       (dev->sprite && dev->sprite->pending_buf >= 0)) {
+		ret = handle_display_events(-1);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until every display scans out what was last presented on it. Returns
+ * a negative error code if waiting for a page flip failed.
+ */
+int wait_displays(void)
+{
+	struct modeset_dev *iter;
+	int ret;
+
+	for (iter = modeset_list; iter; iter = iter->next) {
+		ret = wait_page_flip(iter);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the next buffer of the swapchain that is neither scanned out nor
+ * waiting for a flip, blocking until a pending flip completes if there is no
+ * such buffer. With a single buffer this is always the scanout buffer.
+ */
+struct modeset_buf *get_back_buffer(struct modeset_dev *dev)
+{
+	unsigned int i;
+	int idx;
+
+	if (dev->num_bufs == 1)
+		return &dev->bufs[0];
+
+	for (;;) {
+		for (i = 1; i <= dev->num_bufs; i++) {
+			idx = (dev->back_buf + i) % dev->num_bufs;
+			if (idx != dev->front_buf && idx != dev->pending_buf) {
+				dev->back_buf = idx;
+				return &dev->bufs[idx];
+			}
+		}
+
+		if (wait_page_flip(dev))
+			return NULL;
+	}
+}
+
+static int atomic_add_plane(drmModeAtomicReq *req, struct modeset_dev *dev)
+{
+	struct modeset_props *p = &dev->props;
+	uint32_t fb_id = dev->bufs[dev->back_buf].fb_id;
+	int ret = 0;
+
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_crtc_id, dev->crtc_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_src_x, 0) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_src_y, 0) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_src_w, (uint64_t)dev->width << 16) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_src_h, (uint64_t)dev->height << 16) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_crtc_x, dev->x) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_crtc_y, dev->y) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_crtc_w, dev->width) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_crtc_h, dev->height) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_fb_id, fb_id) < 0;
+
+	return ret ? -ENOMEM : 0;
+}
+
+static int atomic_add_dev(drmModeAtomicReq *req, struct modeset_dev *dev)
+{
+	struct modeset_props *p = &dev->props;
+	int ret = 0;
+
+	if (dev->setmode) {
+		ret |= drmModeAtomicAddProperty(req, dev->conn_id, p->conn_crtc_id, dev->crtc_id) < 0;
+		ret |= drmModeAtomicAddProperty(req, dev->crtc_id, p->crtc_mode_id, dev->mode_blob) < 0;
+		ret |= drmModeAtomicAddProperty(req, dev->crtc_id, p->crtc_active, 1) < 0;
+		if (ret)
+			return -ENOMEM;
+	}
+
+	return atomic_add_plane(req, dev);
+}
+
+/*
+ * Present the back buffers of dev, or of all devices if dev is NULL, in a
+ * single atomic commit. The commit is validated with TEST_ONLY first and then
+ * issued nonblocking, completion is reported through page flip events. If
+ * clips are given, they are passed to the driver as FB_DAMAGE_CLIPS of dev's
+ * plane, if it has that property.
+ */
+static int atomic_update(struct modeset_dev *dev, drmModeClip *clips,
+			 unsigned int num_clips)
+{
+	struct modeset_dev *iter, *first = dev ? dev : modeset_list;
+	drmModeAtomicReq *req;
+	uint64_t start = trace_now();
+	uint32_t flags = 0, damage_blob = 0;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	if (dev && num_clips && dev->props.plane_damage_clips) {
+		ret = drmModeCreatePropertyBlob(drmfd, clips,
+						num_clips * sizeof(*clips),
+						&damage_blob);
+		if (ret)
+			damage_blob = 0;
+		else if (drmModeAtomicAddProperty(req, dev->plane_id,
+						  dev->props.plane_damage_clips,
+						  damage_blob) < 0) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (iter = first; iter; iter = dev ? NULL : iter->next) {
+		/* only one commit can be in flight per CRTC */
+		ret = wait_page_flip(iter);
+		if (ret)
+			goto out;
+
+		ret = atomic_add_dev(req, iter);
+		if (ret)
+			goto out;
+
+		if (iter->setmode)
+			flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	ret = drmModeAtomicCommit(drmfd, req, flags | DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+	if (ret) {
+		ret = -errno;
+		error("Atomic test commit failed: %m\n");
+		goto out;
+	}
+
+	ret = drmModeAtomicCommit(drmfd, req, flags | DRM_MODE_ATOMIC_NONBLOCK |
+				  DRM_MODE_PAGE_FLIP_EVENT, NULL);
+	if (ret) {
+		ret = -errno;
+		error("Atomic commit failed: %m\n");
+		goto out;
+	}
+
+	for (iter = first; iter; iter = dev ? NULL : iter->next) {
+		iter->pending_buf = iter->back_buf;
+		/* the modeset is traced once its flip event says it's shown */
+		if (iter->setmode)
+			iter->modeset_time = start;
+		else if (iter->blanked)
+			/* includes waiting for the blank modeset */
+			iter->present_time = start;
+		iter->setmode = 0;
+		iter->blanked = false;
+	}
+
+out:
+	/* the commit holds its own reference */
+	if (damage_blob)
+		drmModeDestroyPropertyBlob(drmfd, damage_blob);
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+/*
+ * Set the mode with the primary plane disabled, which shows black, and
+ * return right away. The driver trains the link while the caller draws into
+ * the back buffer, the next update_display() then only flips to it after
+ * waiting for the modeset to complete. Fails if the driver can't light up a
+ * CRTC without a plane, the mode is then set along with the first frame.
+ */
+static int atomic_blank(struct modeset_dev *dev)
+{
+	struct modeset_props *p = &dev->props;
+	uint32_t flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+	uint64_t start = trace_now();
+	drmModeAtomicReq *req;
+	int ret = 0;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	ret |= drmModeAtomicAddProperty(req, dev->conn_id, p->conn_crtc_id, dev->crtc_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->crtc_id, p->crtc_mode_id, dev->mode_blob) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->crtc_id, p->crtc_active, 1) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_fb_id, 0) < 0;
+	ret |= drmModeAtomicAddProperty(req, dev->plane_id, p->plane_crtc_id, 0) < 0;
+	if (ret) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (drmModeAtomicCommit(drmfd, req, flags | DRM_MODE_ATOMIC_TEST_ONLY, NULL) ||
+	    drmModeAtomicCommit(drmfd, req, flags | DRM_MODE_ATOMIC_NONBLOCK |
+				DRM_MODE_PAGE_FLIP_EVENT, NULL)) {
+		ret = -errno;
+		debug("no blank modeset on connector #%u: %m\n", dev->conn_id);
+		goto out;
+	}
 
-int update_display(struct modeset_dev *dev) {
+	/* traced until the link is up, see page_flip_handler() */
+	dev->modeset_time = start;
+	/* waited for like a flip, the handler knows the buffer isn't shown */
+	dev->pending_buf = dev->back_buf;
+	dev->setmode = 0;
+	dev->blanked = true;
+
+out:
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+static int legacy_update(struct modeset_dev *dev)
+{
+	struct modeset_buf *buf = &dev->bufs[dev->back_buf];
 	int ret = 0;
 
+	/* atomic was given up after a blank modeset, a flip can't enable the plane */
+	if (dev->blanked) {
+		ret = wait_page_flip(dev);
+		if (ret)
+			return ret;
+		dev->blanked = false;
+		dev->setmode = 1;
+	}
+
 	if (dev->setmode) {
-		ret = drmModeSetCrtc(drmfd, dev->crtc_id, dev->fb_id, 0, 0, &dev->conn_id, 1, &dev->mode);
+		uint64_t start = trace_now();
+
+		ret = drmModeSetCrtc(drmfd, dev->crtc_id, buf->fb_id, 0, 0, &dev->conn_id, 1, &dev->mode);
 		if (ret) {
 			error("Cannot set CRTC for connector #%u: %m\n", dev->conn_id);
+		} else {
+			/* synchronous, the splash is on screen now */
+			trace_phase(TRACE_MODESET, dev->conn_id, start);
+			dev->front_buf = dev->back_buf;
 		}
 		dev->setmode = 0;
 	} else {
-		ret = drmModePageFlip(drmfd, dev->crtc_id, dev->fb_id, 0, NULL);
+		/* only a single flip can be queued per CRTC */
+		ret = wait_page_flip(dev);
+		if (ret)
+			return ret;
+
+		ret = drmModePageFlip(drmfd, dev->crtc_id, buf->fb_id,
+				      DRM_MODE_PAGE_FLIP_EVENT, dev);
 		if (ret) {
 			error("Page flip failed on connector #%u: %m\n", dev->conn_id);
+		} else {
+			dev->pending_buf = dev->back_buf;
 		}
 	}
 	return ret;
 }
 
+/* Present the buffer last returned by get_back_buffer() */
+int update_display(struct modeset_dev *dev)
+{
+	if (atomic && !atomic_update(dev, NULL, 0))
+		return 0;
+
+	return legacy_update(dev);
+}
+
+/* cleared once the driver turns out not to implement DIRTYFB */
+static bool dirtyfb_supported = true;
+
+/*
+ * Like update_display(), but also tell the driver which part of the back
+ * buffer changed. Displays that aren't refreshed continuously (e.g. DSI command
+ * mode, USB) only need to transfer that part. Atomic commits carry the damage
+ * along. With a single buffer that is already scanned out there is nothing to
+ * flip, the driver is only told about the change with DIRTYFB then.
+ */
+int update_display_damage(struct modeset_dev *dev, drmModeClip *clips,
+			  unsigned int num_clips)
+{
+	uint32_t fb_id = dev->bufs[dev->back_buf].fb_id;
+	int ret;
+
+	if (dev->front_buf != dev->back_buf || dev->pending_buf >= 0 ||
+	    dev->setmode) {
+		if (atomic && !atomic_update(dev, clips, num_clips))
+			return 0;
+		return legacy_update(dev);
+	}
+
+	if (!dirtyfb_supported || !num_clips)
+		return 0;
+
+	ret = drmModeDirtyFB(drmfd, fb_id, clips, num_clips);
+	if (ret == -ENOSYS || ret == -EOPNOTSUPP)
+		dirtyfb_supported = false;
+	else if (ret)
+		debug("Failed to mark fb #%u dirty: %s\n", fb_id, strerror(-ret));
+
+	return 0;
+}
+
+/* Present the back buffers of all connectors, atomically if possible */
+int update_displays(void)
+{
+	struct modeset_dev *iter;
+	int ret = 0;
+
+	if (atomic && !atomic_update(NULL, NULL, 0))
+		return 0;
+
+	for (iter = modeset_list; iter; iter = iter->next)
+		ret |= legacy_update(iter);
+
+	return ret;
+}
+
+static const struct platsch_format sprite_format = {
+	DRM_FORMAT_ARGB8888, 32, "ARGB8888"
+};
+
+/*
+ * Attach a small double-buffered ARGB8888 framebuffer on an overlay or cursor
+ * plane to dev's CRTC. Render into it with get_back_buffer(dev->sprite) and
+ * show or move it with update_sprite(), the primary plane stays untouched.
+ */
+int create_sprite(struct modeset_dev *dev, uint32_t width, uint32_t height,
+		  uint32_t plane_type)
+{
+	struct modeset_dev *sprite;
+	drmModeRes *res;
+	uint64_t cap_width, cap_height;
+	int ret;
+
+	if (plane_type == DRM_PLANE_TYPE_CURSOR &&
+	    !drmGetCap(drmfd, DRM_CAP_CURSOR_WIDTH, &cap_width) &&
+	    !drmGetCap(drmfd, DRM_CAP_CURSOR_HEIGHT, &cap_height)) {
+		/* cursors usually only support their native size */
+		if (width > cap_width || height > cap_height) {
+			error("%ux%u exceeds cursor size %ux%u\n", width, height,
+			      (unsigned int)cap_width, (unsigned int)cap_height);
+			return -E2BIG;
+		}
+		width = cap_width;
+		height = cap_height;
+	}
+
+	sprite = malloc(sizeof(*sprite));
+	if (!sprite)
+		return -ENOMEM;
+	memset(sprite, 0, sizeof(*sprite));
+
+	sprite->width = width;
+	sprite->height = height;
+	sprite->format = &sprite_format;
+	sprite->num_bufs = 2;
+	sprite->conn_id = dev->conn_id;
+	sprite->crtc_id = dev->crtc_id;
+	sprite->plane_type = plane_type;
+	sprite->setmode = 1;
+
+	/* the legacy cursor API doesn't need a plane */
+	if (atomic || plane_type != DRM_PLANE_TYPE_CURSOR) {
+		res = drmModeGetResources(drmfd);
+		if (!res) {
+			ret = -errno;
+			error("cannot retrieve DRM resources: %m\n");
+			goto err_free;
+		}
+
+		ret = find_plane(drmfd, res, dev, plane_type,
+				 sprite->format->format, &sprite->plane_id);
+		drmModeFreeResources(res);
+		if (ret) {
+			error("No free %s plane for crtc #%u\n",
+			      plane_type == DRM_PLANE_TYPE_CURSOR ? "cursor" : "overlay",
+			      dev->crtc_id);
+			goto err_free;
+		}
+	}
+
+	if (atomic) {
+		ret = lookup_plane_props(drmfd, sprite);
+		if (ret)
+			goto err_free;
+	}
+
+	ret = modeset_create_fb(drmfd, sprite);
+	if (ret)
+		goto err_free;
+
+	debug("crtc #%u uses plane #%u for a %ux%u sprite\n", dev->crtc_id,
+	      sprite->plane_id, width, height);
+	dev->sprite = sprite;
+
+	return 0;
+
+err_free:
+	free(sprite);
+	return ret;
+}
+
+static int atomic_update_sprite(struct modeset_dev *dev, bool enable)
+{
+	struct modeset_dev *sprite = dev->sprite;
+	drmModeAtomicReq *req;
+	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+	int ret;
+
+	ret = wait_page_flip(dev);
+	if (ret)
+		return ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	if (enable) {
+		ret = atomic_add_plane(req, sprite);
+	} else {
+		ret = (drmModeAtomicAddProperty(req, sprite->plane_id, sprite->props.plane_fb_id, 0) < 0 ||
+		       drmModeAtomicAddProperty(req, sprite->plane_id, sprite->props.plane_crtc_id, 0) < 0) ? -ENOMEM : 0;
+		flags = 0;
+	}
+	if (ret)
+		goto out;
+
+	/* the plane configuration is only validated once */
+	if (sprite->setmode || !enable) {
+		ret = drmModeAtomicCommit(drmfd, req, DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+		if (ret) {
+			ret = -errno;
+			error("Atomic sprite test commit failed: %m\n");
+			goto out;
+		}
+	}
+
+	ret = drmModeAtomicCommit(drmfd, req, flags, NULL);
+	if (ret) {
+		ret = -errno;
+		error("Atomic sprite commit failed: %m\n");
+		goto out;
+	}
+
+	if (enable) {
+		sprite->pending_buf = sprite->back_buf;
+		sprite->setmode = 0;
+	}
+
+out:
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+static int legacy_update_sprite(struct modeset_dev *dev, bool enable)
+{
+	struct modeset_dev *sprite = dev->sprite;
+	struct modeset_buf *buf = &sprite->bufs[sprite->back_buf];
+	int ret;
+
+	if (sprite->plane_type == DRM_PLANE_TYPE_CURSOR) {
+		if (!enable)
+			return drmModeSetCursor(drmfd, dev->crtc_id, 0, 0, 0);
+
+		if (sprite->front_buf != sprite->back_buf) {
+			ret = drmModeSetCursor(drmfd, dev->crtc_id, buf->handle,
+					       sprite->width, sprite->height);
+			if (ret) {
+				error("Cannot set cursor on crtc #%u: %m\n", dev->crtc_id);
+				return ret;
+			}
+		}
+		ret = drmModeMoveCursor(drmfd, dev->crtc_id, sprite->x, sprite->y);
+	} else {
+		if (!enable)
+			return drmModeSetPlane(drmfd, sprite->plane_id, 0, 0, 0,
+					       0, 0, 0, 0, 0, 0, 0, 0);
+
+		ret = drmModeSetPlane(drmfd, sprite->plane_id, dev->crtc_id,
+				      buf->fb_id, 0, sprite->x, sprite->y,
+				      sprite->width, sprite->height, 0, 0,
+				      sprite->width << 16, sprite->height << 16);
+	}
+	if (ret) {
+		error("Cannot update sprite on crtc #%u: %m\n", dev->crtc_id);
+		return ret;
+	}
+
+	/* legacy plane updates complete synchronously */
+	sprite->front_buf = sprite->back_buf;
+
+	return 0;
+}
+
+/*
+ * Show the sprite buffer last returned by get_back_buffer(dev->sprite) with
+ * its top left corner at x/y of dev's CRTC.
+ */
+int update_sprite(struct modeset_dev *dev, int32_t x, int32_t y)
+{
+	struct modeset_dev *sprite = dev->sprite;
+
+	if (!sprite)
+		return -EINVAL;
+
+	sprite->x = x;
+	sprite->y = y;
+
+	if (atomic)
+		return atomic_update_sprite(dev, true);
+
+	return legacy_update_sprite(dev, true);
+}
+
+static void free_sprite(struct modeset_dev *dev)
+{
+	struct modeset_dev *sprite = dev->sprite;
+	unsigned int i;
+
+	for (i = 0; i < sprite->num_bufs; i++)
+		modeset_destroy_buf(drmfd, sprite, &sprite->bufs[i]);
+	free(sprite);
+	dev->sprite = NULL;
+}
+
+/* Disable the sprite's plane and free its buffers */
+void destroy_sprite(struct modeset_dev *dev)
+{
+	if (!dev->sprite)
+		return;
+
+	if (atomic)
+		atomic_update_sprite(dev, false);
+	else
+		legacy_update_sprite(dev, false);
+
+	free_sprite(dev);
+}
+
 int draw(struct modeset_dev *dev, const char *dir, const char *base)
 {
+	struct modeset_buf *buf = &dev->bufs[dev->back_buf];
 	int ret = 0;
+
 	ret = draw_buffer(dev, dir, base);
 	if (ret) {
 		error("Failed to draw buffer\n");
+		/* the buffer has never been cleared, show all-black instead */
+		blit_clear(buf->map, dev->stride, dev->stride, dev->height);
 		return ret;
 	}
-	return update_display(dev);
+	return 0;
+}
+
+/*
+ * Replace the process by the resident holder (platsch-hold), which keeps only
+ * the DRM fd open until another master shows its own framebuffers. All
+ * mappings and allocations go away with the exec. Returns only on failure.
+ */
+int exec_holder(const char *holder)
+{
+	struct modeset_dev *iter;
+	char fd_arg[16], **argv;
+	unsigned int n = 2;
+	int buf, ret;
+
+	for (iter = modeset_list; iter; iter = iter->next)
+		n++;
+
+	argv = calloc(n + 1, sizeof(*argv));
+	if (!argv)
+		return -ENOMEM;
+
+	snprintf(fd_arg, sizeof(fd_arg), "%d", drmfd);
+	n = 0;
+	argv[n++] = (char *)holder;
+	argv[n++] = fd_arg;
+
+	for (iter = modeset_list; iter; iter = iter->next) {
+		/* a pending flip completes regardless */
+		buf = iter->pending_buf >= 0 ? iter->pending_buf : iter->front_buf;
+		if (buf < 0)
+			continue;
+		argv[n] = malloc(24);
+		if (!argv[n]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		snprintf(argv[n++], 24, "%u:%u", iter->crtc_id,
+			 iter->bufs[buf].fb_id);
+	}
+
+	drmDropMaster(drmfd);
+	fcntl(drmfd, F_SETFD, 0);
+
+	execv(holder, argv);
+
+	ret = -errno;
+	error("Failed to exec %s: %m\n", holder);
+	fcntl(drmfd, F_SETFD, FD_CLOEXEC);
+
+out:
+	while (n-- > 2)
+		free(argv[n]);
+	free(argv);
+
+	return ret;
 }
 
 int finish(void) {
@@ -600,15 +2335,18 @@ int finish(void) {
 }
 
 void deinit(void) {
-	struct modeset_dev *iter;
+	struct modeset_dev *iter, *next;
+	unsigned int i;
 
-	for (iter = modeset_list; iter; iter = iter->next) {
-		if (iter->map) {
-			munmap(iter->map, iter->size);
-		}
-		if (iter->fb_id) {
-			drmModeRmFB(drmfd, iter->fb_id);
-		}
+	for (iter = modeset_list; iter; iter = next) {
+		next = iter->next;
+		for (i = 0; i < iter->num_bufs; i++)
+			modeset_destroy_buf(drmfd, iter, &iter->bufs[i]);
+		if (iter->mode_blob)
+			drmModeDestroyPropertyBlob(drmfd, iter->mode_blob);
+		if (iter->sprite)
+			free_sprite(iter);
 		free(iter);
 	}
+	modeset_list = NULL;
 }
@@ -15,6 +15,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <fcntl.h>
 
 #include <xf86drm.h>
@@ -34,6 +35,33 @@ struct platsch_format {
 	const char *name;
 };
 
+/* upper limit for the number of buffers in a connector's swapchain */
+#define MODESET_MAX_BUFFERS 3
+
+/* KMS property IDs needed for atomic commits */
+struct modeset_props {
+	uint32_t conn_crtc_id;
+	uint32_t crtc_mode_id;
+	uint32_t crtc_active;
+	uint32_t plane_fb_id;
+	uint32_t plane_crtc_id;
+	uint32_t plane_src_x;
+	uint32_t plane_src_y;
+	uint32_t plane_src_w;
+	uint32_t plane_src_h;
+	uint32_t plane_crtc_x;
+	uint32_t plane_crtc_y;
+	uint32_t plane_crtc_w;
+	uint32_t plane_crtc_h;
+	uint32_t plane_damage_clips;	/* optional, 0 if not supported */
+};
+
+struct modeset_buf {
+	uint32_t handle;
+	uint32_t fb_id;
+	void *map;
+};
+
 struct modeset_dev {
 	struct modeset_dev *next;
 	uint32_t width;
@@ -41,21 +69,120 @@ struct modeset_dev {
 	uint32_t stride;
 	uint32_t size;
 	const struct platsch_format *format;
-	uint32_t handle;
-	void *map;
+	struct modeset_buf bufs[MODESET_MAX_BUFFERS];
+	unsigned int num_bufs;
+	int front_buf;		/* currently scanned out, -1 if none */
+	int back_buf;		/* handed out for rendering */
+	int pending_buf;	/* queued for a page flip, -1 if none */
+	unsigned int flip_seq;	/* vblank sequence of the last completed flip */
+	struct timeval flip_time;
+	uint64_t modeset_time;	/* trace_now() of a modeset waiting for its flip */
+	uint64_t present_time;	/* same for the splash after a blank modeset */
 	bool setmode;
+	bool blanked;		/* mode set with the primary plane off */
 	drmModeModeInfo mode;
-	uint32_t fb_id;
 	uint32_t conn_id;
+	uint32_t conn_type;
+	uint32_t conn_type_id;
 	uint32_t crtc_id;
+	uint32_t plane_id;	/* primary plane, atomic only */
+	uint32_t plane_type;	/* DRM_PLANE_TYPE_* of plane_id */
+	int32_t x;		/* plane position on the CRTC */
+	int32_t y;
+	uint32_t mode_blob;
+	struct modeset_props props;
+	struct modeset_dev *sprite;	/* see create_sprite() */
+};
+
+/* boot phases timed by trace_phase(), see trace.c */
+enum trace_phase {
+	TRACE_DISCOVERY,	/* finding and opening the DRM device */
+	TRACE_PREPARE,		/* probing a connector, including TRACE_FB */
+	TRACE_FB,		/* allocating a connector's framebuffers */
+	TRACE_DETECT,		/* looking for the splash image */
+	TRACE_DECODE,		/* loading it into the framebuffer */
+	TRACE_TEXT,		/* drawing the overlay text */
+	TRACE_MODESET,		/* until the mode is set and scanned out */
+	TRACE_PRESENT,		/* showing the splash after a blank modeset */
+	TRACE_PHASES,
 };
 
+uint64_t trace_now(void);
+void trace_phase(enum trace_phase phase, uint32_t conn_id, uint64_t start);
+void trace_phase_end(enum trace_phase phase, uint32_t conn_id, uint64_t start,
+		     uint64_t end);
+void trace_summary(void);
+
 ssize_t readfull(int fd, void *buf, size_t count);
-struct modeset_dev * init(void);
+const struct platsch_format *platsch_format_find(const char *name);
+const struct platsch_format *platsch_format_get(uint32_t format);
+struct modeset_dev * init(unsigned int num_bufs);
+struct modeset_dev *init_and_draw(unsigned int num_bufs, const char *dir,
+				  const char *base);
+int show_splash(void);
 
 int draw(struct modeset_dev *dev, const char *dir, const char *base);
 int finish(void);
+int exec_holder(const char *holder);
 int update_display(struct modeset_dev *dev);
+int update_displays(void);
+int update_display_damage(struct modeset_dev *dev, drmModeClip *clips,
+			  unsigned int num_clips);
+
+struct modeset_buf *get_back_buffer(struct modeset_dev *dev);
+int display_fd(void);
+int handle_display_events(int timeout_ms);
+int wait_displays(void);
+
+void blit_rows(void *dst, uint32_t dst_stride, const void *src,
+	       uint32_t src_stride, size_t row_len, uint32_t rows);
+void blit_clear(void *dst, uint32_t dst_stride, size_t row_len, uint32_t rows);
+int map_file(const char *filename, const void **map, size_t *size,
+	     bool sequential);
+int blit_image(struct modeset_dev *dev, void *dst, const void *src, size_t size,
+	       const struct platsch_format *format, const char *name);
+int blit_file(struct modeset_dev *dev, void *dst, const char *filename,
+	      const struct platsch_format *format);
+int rle_image(struct modeset_dev *dev, void *dst, const void *data, size_t size,
+	      const struct platsch_format *format, const char *name);
+int rle_file(struct modeset_dev *dev, void *dst, const char *filename,
+	     const struct platsch_format *format);
+int qoi_image(struct modeset_dev *dev, void *dst, const void *data, size_t size,
+	      const char *name);
+int qoi_file(struct modeset_dev *dev, void *dst, const char *filename,
+	     const struct platsch_format *format);
+int bundle_lookup(struct modeset_dev *dev, const char *dir, const char *base,
+		  const struct platsch_format **format);
+int bundle_draw(struct modeset_dev *dev, void *dst, const char *dir,
+		const char *base);
+const void *bundle_asset(const char *dir, const char *base, const char *name,
+			 size_t *size);
+int convert_rows(void *dst, uint32_t dst_stride, uint32_t dst_format,
+		 const void *src, uint32_t src_stride, uint32_t width,
+		 uint32_t rows, uint32_t y);
+bool convert_dither(void);
+
+struct glyphs;
+struct glyphs_entry;
+struct glyphs_extents;
+uint32_t glyphs_utf8_next(const char **s);
+int glyphs_open(struct glyphs *g, const char *dir, const char *base,
+		const char *font, unsigned int size);
+void glyphs_close(struct glyphs *g);
+const struct glyphs_entry *glyphs_find(const struct glyphs *g, uint32_t codepoint);
+int glyphs_text_extents(const struct glyphs *g, const char *text,
+			struct glyphs_extents *ext);
+
+struct handoff_msg;
+int handoff_serve(struct modeset_dev *list, const char *path, uid_t uid);
+int handoff_receive(const char *path, struct handoff_msg *msgs, int *fds,
+		    unsigned int max, unsigned int *count);
+int handoff_ack(int sock);
+
+int create_sprite(struct modeset_dev *dev, uint32_t width, uint32_t height,
+		  uint32_t plane_type);
+void destroy_sprite(struct modeset_dev *dev);
+int update_sprite(struct modeset_dev *dev, int32_t x, int32_t y);
 
 #ifndef HAVE_CAIRO
 static inline int cairo_draw_buffer(struct modeset_dev *dev, const char *dir, const char *base)
@@ -68,6 +195,9 @@ static inline int cairo_draw_buffer(struct modeset_dev *dev, const char *dir, co
 #include <cairo.h>
 int cairo_draw_buffer(struct modeset_dev *dev, const char *dir, const char *base);
 cairo_t *cairo_init(struct modeset_dev *dev, const char *dir, const char *base);
+cairo_surface_t *cairo_load_png(const char *filename, const char *dir,
+				const char *base);
+int cairo_show_atlas_text(cairo_t *cr, const struct glyphs *g, const char *text);
 
 #endif /* HAVE_CAIRO */
 
@@ -77,7 +77,6 @@ int main(int argc, char *argv[])
 	char **initsargv;
 	//int drmfd;
 	//char drmdev[128];
-	struct modeset_dev *iter;
 	bool pid1 = getpid() == 1;
 	const char *dir = "/usr/share/platsch";
 	const char *base = "splash";
@@ -118,21 +117,19 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	struct modeset_dev *modeset_list = init();
+	/* the splash is drawn only once, so there is no need for a back buffer */
+	struct modeset_dev *modeset_list = init_and_draw(1, dir, base);
 	if (!modeset_list) {
 		error("Failed to initialize modeset\n");
 		return EXIT_FAILURE;
 	}
-	for (iter = modeset_list; iter; iter = iter->next) {
-		draw(iter,dir,base);
-	}
-
-	finish();
 
 	if (pid1) {
 		ret = fork();
 		if (ret < 0) {
 			error("failed to fork for init: %m\n");
+			show_splash();
+			finish();
 		} else if (ret == 0) {
 			/*
 			 * in the child go to sleep to keep the drm device open
@@ -158,8 +155,39 @@ int main(int argc, char *argv[])
 	}
 
 sleep:
+	/*
+	 * Links may still be training, init doesn't wait for that. The DRM fd
+	 * is close-on-exec, so only this process holds master meanwhile.
+	 */
+	show_splash();
+	finish();
+
 	redirect_stdfd();
 
+	/* hand the buffers over to a successor instead of holding them forever */
+	env = getenv("platsch_handoff");
+	if (env) {
+		const char *uid_env = getenv("platsch_handoff_uid");
+		uid_t uid = (uid_t)-1;
+		char *end;
+
+		if (uid_env) {
+			uid = strtoul(uid_env, &end, 10);
+			if (!*uid_env || *end) {
+				error("invalid platsch_handoff_uid %s\n", uid_env);
+				uid = (uid_t)-1;
+			}
+		}
+
+		if (!handoff_serve(modeset_list, env, uid))
+			return 0;
+	}
+
+	/* or keep only the DRM fd open, in a process that has nothing else */
+	env = getenv("platsch_holder");
+	if (env)
+		exec_holder(env);
+
 	do {
 		sleep(10);
 	} while (1);
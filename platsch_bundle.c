@@ -0,0 +1,269 @@
+/*
+ * Pack splash images, spinner sprites and fonts into a single bundle platsch
+ * maps once at startup, see bundle.h.
+ *
+ *   platsch-bundle -o <dir>/<base>.bundle <file>...
+ *
+ * Files are classified by name:
+ *   <base>-<width>x<height>-<format>.bin   raw splash image
+ *   <base>-<width>x<height>-<format>.rle   RLE splash image
+ *   <base>-<width>x<height>.qoi            QOI splash image
+ *   *.ttf, *.otf, *.glyphs                 font
+ *   anything else                          spinner sprite, e.g. PNG
+ *
+ * Sprites and fonts are looked up by their file name without directory. The
+ * index is written little endian, whatever the build host is.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "bundle.h"
+#include "rle.h"
+
+struct input {
+	const char *path;
+	const uint8_t *map;
+	struct bundle_entry entry;
+};
+
+static bool has_ext(const char *path, const char *ext)
+{
+	const char *p = strrchr(path, '.');
+
+	return p && !strcmp(p + 1, ext);
+}
+
+/* <base>-<width>x<height>[-<format>].<ext>, base may contain '-' */
+static int parse_name(const char *path, uint32_t *width, uint32_t *height,
+		      char *fmt_name)
+{
+	const char *p = strrchr(path, '/');
+
+	p = p ? p + 1 : path;
+	while ((p = strchr(p, '-'))) {
+		p++;
+		if (fmt_name &&
+		    sscanf(p, "%ux%u-%31[^.]", width, height, fmt_name) == 3)
+			return 0;
+		if (!fmt_name && sscanf(p, "%ux%u.", width, height) == 2)
+			return 0;
+	}
+
+	error("Cannot parse resolution%s from %s\n",
+	      fmt_name ? " and format" : "", path);
+	return -EINVAL;
+}
+
+static int classify(struct input *in, size_t size)
+{
+	struct bundle_entry *e = &in->entry;
+	const struct platsch_format *format;
+	const struct rle_header *rle;
+	char fmt_name[32];
+	const char *name;
+
+	name = strrchr(in->path, '/');
+	name = name ? name + 1 : in->path;
+	if (strlen(name) >= sizeof(e->name)) {
+		error("Name of %s is too long\n", in->path);
+		return -EINVAL;
+	}
+	strcpy(e->name, name);
+	e->size = size;
+
+	if (has_ext(name, "bin")) {
+		if (parse_name(name, &e->width, &e->height, fmt_name))
+			return -EINVAL;
+		format = platsch_format_find(fmt_name);
+		if (!format) {
+			error("Unknown format %s\n", fmt_name);
+			return -EINVAL;
+		}
+		e->type = BUNDLE_SPLASH;
+		e->encoding = BUNDLE_RAW;
+		e->format = format->format;
+	} else if (has_ext(name, "rle")) {
+		rle = (const void *)in->map;
+		if (size < sizeof(*rle) ||
+		    memcmp(rle->magic, RLE_MAGIC, sizeof(rle->magic)) ||
+		    le32toh(rle->version) != RLE_VERSION) {
+			error("%s is no RLE image of version %u\n", in->path,
+			      RLE_VERSION);
+			return -EINVAL;
+		}
+		e->type = BUNDLE_SPLASH;
+		e->encoding = BUNDLE_RLE;
+		e->width = le32toh(rle->width);
+		e->height = le32toh(rle->height);
+		e->format = le32toh(rle->format);
+	} else if (has_ext(name, "qoi")) {
+		if (parse_name(name, &e->width, &e->height, NULL))
+			return -EINVAL;
+		e->type = BUNDLE_SPLASH;
+		e->encoding = BUNDLE_QOI;
+	} else if (has_ext(name, "ttf") || has_ext(name, "otf") ||
+		   has_ext(name, "glyphs")) {
+		e->type = BUNDLE_FONT;
+		e->encoding = BUNDLE_FILE;
+	} else {
+		e->type = BUNDLE_SPRITE;
+		e->encoding = BUNDLE_FILE;
+	}
+
+	return 0;
+}
+
+static int write_entry(FILE *out, const struct bundle_entry *e)
+{
+	struct bundle_entry le = {
+		.type = htole32(e->type),
+		.encoding = htole32(e->encoding),
+		.width = htole32(e->width),
+		.height = htole32(e->height),
+		.format = htole32(e->format),
+		.offset = htole64(e->offset),
+		.size = htole64(e->size),
+	};
+
+	memcpy(le.name, e->name, sizeof(le.name));
+
+	return fwrite(&le, sizeof(le), 1, out) != 1 ? -EIO : 0;
+}
+
+static int pad_to(FILE *out, uint64_t offset)
+{
+	long pos = ftell(out);
+
+	if (pos < 0)
+		return -EIO;
+
+	for (; pos < offset; pos++)
+		if (fputc(0, out) == EOF)
+			return -EIO;
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	error("Usage:\n"
+	      "%s -o|--output <file> <file>...\n"
+	      "   [-h|--help]\n",
+	      prog);
+}
+
+static struct option longopts[] =
+{
+	{ "help",   no_argument,       0, 'h' },
+	{ "output", required_argument, 0, 'o' },
+	{ NULL,     0,                 0, 0   }
+};
+
+int main(int argc, char *argv[])
+{
+	struct bundle_header hdr = { .magic = BUNDLE_MAGIC };
+	struct input *inputs;
+	const char *output = NULL;
+	uint64_t offset;
+	unsigned int count, i;
+	struct stat s;
+	FILE *out;
+	int fd, c, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "ho:", longopts, NULL)) != EOF) {
+		switch (c) {
+		case 'o':
+			output = optarg;
+			break;
+		case '?':
+			ret = 1;
+			/* FALLTHRU */
+		case 'h':
+			usage(basename(argv[0]));
+			exit(ret);
+		}
+	}
+
+	if (!output || optind == argc) {
+		usage(basename(argv[0]));
+		exit(1);
+	}
+
+	count = argc - optind;
+	inputs = calloc(count, sizeof(*inputs));
+	if (!inputs)
+		exit(1);
+
+	offset = sizeof(hdr) + count * sizeof(struct bundle_entry);
+
+	for (i = 0; i < count; i++) {
+		struct input *in = &inputs[i];
+
+		in->path = argv[optind + i];
+		fd = open(in->path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || fstat(fd, &s) < 0 || !s.st_size) {
+			error("Failed to open %s: %m\n", in->path);
+			exit(1);
+		}
+
+		in->map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (in->map == MAP_FAILED) {
+			error("Failed to mmap %s: %m\n", in->path);
+			exit(1);
+		}
+		close(fd);
+
+		if (classify(in, s.st_size))
+			exit(1);
+
+		/* page aligned, so every payload is mapped on its own pages */
+		offset = (offset + BUNDLE_ALIGN - 1) & ~(uint64_t)(BUNDLE_ALIGN - 1);
+		in->entry.offset = offset;
+		offset += s.st_size;
+	}
+
+	out = fopen(output, "wb");
+	if (!out) {
+		error("Failed to open %s: %m\n", output);
+		exit(1);
+	}
+
+	hdr.version = htole32(BUNDLE_VERSION);
+	hdr.count = htole32(count);
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		ret = -EIO;
+
+	for (i = 0; i < count && !ret; i++)
+		ret = write_entry(out, &inputs[i].entry);
+
+	for (i = 0; i < count && !ret; i++) {
+		ret = pad_to(out, inputs[i].entry.offset);
+		if (!ret && fwrite(inputs[i].map, inputs[i].entry.size, 1, out) != 1)
+			ret = -EIO;
+	}
+
+	if (fclose(out) || ret) {
+		error("Failed to write %s\n", output);
+		unlink(output);
+		exit(1);
+	}
+
+	for (i = 0; i < count; i++)
+		printf("%s: %s %ux%u at %llu\n", output, inputs[i].entry.name,
+		       inputs[i].entry.width, inputs[i].entry.height,
+		       (unsigned long long)inputs[i].entry.offset);
+
+	return 0;
+}
@@ -0,0 +1,333 @@
+/*
+ * Render the glyphs of a font at one size into an atlas platsch and the
+ * spinner draw text from without fontconfig and FreeType, see glyphs.h.
+ *
+ *   platsch-glyphs -f <font> -s <size> [-c <characters>] [-o <output>]
+ *
+ * The printable ASCII characters are always included, -c adds more as UTF-8.
+ * The output defaults to splash-<font>-<size>.glyphs, which is where platsch
+ * looks for it with the default basename.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cairo.h>
+
+#include "libplatsch.h"
+#include "glyphs.h"
+
+#define ATLAS_WIDTH	1024
+
+static int cmp_codepoint(const void *a, const void *b)
+{
+	const struct glyphs_entry *x = a, *y = b;
+
+	return (x->codepoint > y->codepoint) - (x->codepoint < y->codepoint);
+}
+
+static int add_codepoint(struct glyphs_entry **entries, unsigned int *count,
+			 uint32_t codepoint)
+{
+	struct glyphs_entry *e;
+	unsigned int i;
+
+	for (i = 0; i < *count; i++)
+		if ((*entries)[i].codepoint == codepoint)
+			return 0;
+
+	e = realloc(*entries, (*count + 1) * sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+
+	memset(&e[*count], 0, sizeof(*e));
+	e[*count].codepoint = codepoint;
+	*entries = e;
+	(*count)++;
+
+	return 0;
+}
+
+static void utf8_encode(uint32_t cp, char *s)
+{
+	if (cp < 0x80) {
+		*s++ = cp;
+	} else if (cp < 0x800) {
+		*s++ = 0xc0 | cp >> 6;
+		*s++ = 0x80 | (cp & 0x3f);
+	} else if (cp < 0x10000) {
+		*s++ = 0xe0 | cp >> 12;
+		*s++ = 0x80 | (cp >> 6 & 0x3f);
+		*s++ = 0x80 | (cp & 0x3f);
+	} else {
+		*s++ = 0xf0 | cp >> 18;
+		*s++ = 0x80 | (cp >> 12 & 0x3f);
+		*s++ = 0x80 | (cp >> 6 & 0x3f);
+		*s++ = 0x80 | (cp & 0x3f);
+	}
+	*s = '\0';
+}
+
+static void set_font(cairo_t *cr, const char *font, unsigned int size)
+{
+	cairo_select_font_face(cr, font, CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, size);
+}
+
+/* Measure every glyph and place it in the atlas, rows of glyphs top down */
+static uint32_t layout(struct glyphs_entry *entries, unsigned int count,
+		       const char *font, unsigned int size)
+{
+	cairo_surface_t *surface;
+	cairo_text_extents_t ext;
+	unsigned int i, x = 0, y = 0, row = 0;
+	int x1, y1, x2, y2;
+	char s[8];
+	cairo_t *cr;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+	cr = cairo_create(surface);
+	set_font(cr, font, size);
+
+	for (i = 0; i < count; i++) {
+		struct glyphs_entry *e = &entries[i];
+
+		utf8_encode(e->codepoint, s);
+		cairo_text_extents(cr, s, &ext);
+
+		/* one pixel of room for antialiasing on each side */
+		x1 = floor(ext.x_bearing) - 1;
+		y1 = floor(ext.y_bearing) - 1;
+		x2 = ceil(ext.x_bearing + ext.width) + 1;
+		y2 = ceil(ext.y_bearing + ext.height) + 1;
+
+		e->advance = lround(ext.x_advance * 64);
+		if (!ext.width || !ext.height)
+			continue;
+
+		e->bearing_x = x1;
+		e->bearing_y = y1;
+		e->width = x2 - x1;
+		e->height = y2 - y1;
+
+		if (x + e->width > ATLAS_WIDTH) {
+			x = 0;
+			y += row;
+			row = 0;
+		}
+		e->x = x;
+		e->y = y;
+		x += e->width;
+		if (e->height > row)
+			row = e->height;
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+
+	return y + row;
+}
+
+static cairo_surface_t *render(const struct glyphs_entry *entries,
+			       unsigned int count, const char *font,
+			       unsigned int size, uint32_t height)
+{
+	cairo_surface_t *surface;
+	unsigned int i;
+	char s[8];
+	cairo_t *cr;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_A8, ATLAS_WIDTH,
+					     height ? height : 1);
+	cr = cairo_create(surface);
+	set_font(cr, font, size);
+
+	for (i = 0; i < count; i++) {
+		const struct glyphs_entry *e = &entries[i];
+
+		if (!e->width)
+			continue;
+
+		utf8_encode(e->codepoint, s);
+		cairo_save(cr);
+		cairo_rectangle(cr, e->x, e->y, e->width, e->height);
+		cairo_clip(cr);
+		cairo_move_to(cr, e->x - e->bearing_x, e->y - e->bearing_y);
+		cairo_show_text(cr, s);
+		cairo_restore(cr);
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+
+	return surface;
+}
+
+static void usage(const char *prog)
+{
+	error("Usage:\n"
+	      "%s -f|--font <font> -s|--size <size> [-c|--chars <characters>]\n"
+	      "   [-o|--output <file>] [-h|--help]\n",
+	      prog);
+}
+
+static int write_header(FILE *out, const struct glyphs_header *hdr)
+{
+	struct glyphs_header le = {
+		.magic = GLYPHS_MAGIC,
+		.version = htole32(hdr->version),
+		.count = htole32(hdr->count),
+		.size = htole32(hdr->size),
+		.width = htole32(hdr->width),
+		.height = htole32(hdr->height),
+		.stride = htole32(hdr->stride),
+	};
+
+	memcpy(le.font, hdr->font, sizeof(le.font));
+
+	return fwrite(&le, sizeof(le), 1, out) != 1 ? -EIO : 0;
+}
+
+static int write_entries(FILE *out, const struct glyphs_entry *entries,
+			 unsigned int count)
+{
+	struct glyphs_entry le;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		le.codepoint = htole32(entries[i].codepoint);
+		le.x = htole16(entries[i].x);
+		le.y = htole16(entries[i].y);
+		le.width = htole16(entries[i].width);
+		le.height = htole16(entries[i].height);
+		le.bearing_x = htole16(entries[i].bearing_x);
+		le.bearing_y = htole16(entries[i].bearing_y);
+		le.advance = htole32(entries[i].advance);
+		if (fwrite(&le, sizeof(le), 1, out) != 1)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static struct option longopts[] =
+{
+	{ "help",   no_argument,       0, 'h' },
+	{ "font",   required_argument, 0, 'f' },
+	{ "size",   required_argument, 0, 's' },
+	{ "chars",  required_argument, 0, 'c' },
+	{ "output", required_argument, 0, 'o' },
+	{ NULL,     0,                 0, 0   }
+};
+
+int main(int argc, char *argv[])
+{
+	struct glyphs_header hdr = { .magic = GLYPHS_MAGIC, .version = GLYPHS_VERSION };
+	struct glyphs_entry *entries = NULL;
+	const char *font = NULL, *chars = "";
+	char *output = NULL;
+	cairo_surface_t *surface;
+	const unsigned char *data;
+	unsigned int count = 0, y;
+	uint32_t cp;
+	FILE *out;
+	int c, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "hf:s:c:o:", longopts, NULL)) != EOF) {
+		switch (c) {
+		case 'f':
+			font = optarg;
+			break;
+		case 's':
+			hdr.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			chars = optarg;
+			break;
+		case 'o':
+			output = strdup(optarg);
+			break;
+		case '?':
+			ret = 1;
+			/* FALLTHRU */
+		case 'h':
+			usage(basename(argv[0]));
+			exit(ret);
+		}
+	}
+
+	if (!font || !hdr.size || optind != argc || strlen(font) >= GLYPHS_FONT_LEN) {
+		usage(basename(argv[0]));
+		exit(1);
+	}
+	strcpy(hdr.font, font);
+
+	if (!output) {
+		output = malloc(strlen(font) + 32);
+		if (!output)
+			exit(1);
+		sprintf(output, "splash-%s-%u.glyphs", font, hdr.size);
+	}
+
+	for (cp = 0x20; cp < 0x7f; cp++)
+		if (add_codepoint(&entries, &count, cp))
+			exit(1);
+	while (*chars)
+		if (add_codepoint(&entries, &count, glyphs_utf8_next(&chars)))
+			exit(1);
+	qsort(entries, count, sizeof(*entries), cmp_codepoint);
+
+	hdr.count = count;
+	hdr.width = ATLAS_WIDTH;
+	hdr.height = layout(entries, count, font, hdr.size);
+	if (hdr.height > UINT16_MAX) {
+		error("Too many glyphs for one atlas\n");
+		exit(1);
+	}
+
+	surface = render(entries, count, font, hdr.size, hdr.height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to render glyphs\n");
+		exit(1);
+	}
+	hdr.stride = cairo_image_surface_get_stride(surface);
+	data = cairo_image_surface_get_data(surface);
+
+	out = fopen(output, "wb");
+	if (!out) {
+		error("Failed to open %s: %m\n", output);
+		exit(1);
+	}
+
+	ret = write_header(out, &hdr);
+	if (!ret)
+		ret = write_entries(out, entries, count);
+
+	for (y = 0; y < hdr.height && !ret; y++)
+		if (fwrite(data + (size_t)y * hdr.stride, hdr.stride, 1, out) != 1)
+			ret = -EIO;
+
+	if (fclose(out) || ret) {
+		error("Failed to write %s\n", output);
+		unlink(output);
+		exit(1);
+	}
+
+	printf("%s: %u glyphs, %ux%u atlas\n", output, count, hdr.width,
+	       hdr.height);
+
+	cairo_surface_destroy(surface);
+	free(entries);
+	free(output);
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Resident holder for the splash, exec'ed by platsch and spinner when
+ * platsch_holder is set:
+ *
+ *   platsch-hold <drm fd> <crtc id>:<fb id>...
+ *
+ * Framebuffers live as long as the DRM file they were created on, so
+ * something has to keep it open while the splash is shown. This does so
+ * without anything else mapped: no buffer mappings, no libdrm or cairo and no
+ * heap. It exits once none of the CRTCs shows its framebuffer anymore, i.e.
+ * another DRM master took over, or the device went away.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <drm.h>
+
+#define MAX_CRTCS	16
+#define POLL_SECONDS	1
+
+static int still_shown(int fd, const uint32_t *crtcs, const uint32_t *fbs,
+		       unsigned int n)
+{
+	struct drm_mode_crtc crtc;
+	unsigned int i, shown = 0;
+
+	for (i = 0; i < n; i++) {
+		crtc = (struct drm_mode_crtc){ .crtc_id = crtcs[i] };
+		if (ioctl(fd, DRM_IOCTL_MODE_GETCRTC, &crtc) < 0) {
+			if (errno == EINTR)
+				return 1;
+			return -errno;
+		}
+		if (crtc.fb_id == fbs[i])
+			shown++;
+	}
+
+	return shown;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t crtcs[MAX_CRTCS], fbs[MAX_CRTCS];
+	unsigned int n = 0;
+	char *end;
+	int fd, i;
+
+	if (argc < 3)
+		return 1;
+
+	fd = strtol(argv[1], &end, 10);
+	if (*end || fd < 0)
+		return 1;
+
+	for (i = 2; i < argc && n < MAX_CRTCS; i++) {
+		crtcs[n] = strtoul(argv[i], &end, 10);
+		if (*end != ':')
+			return 1;
+		fbs[n] = strtoul(end + 1, &end, 10);
+		if (*end)
+			return 1;
+		n++;
+	}
+
+	while (still_shown(fd, crtcs, fbs, n) > 0)
+		sleep(POLL_SECONDS);
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Encode raw splash images into the run-length encoded format platsch can
+ * decode while loading, see rle.h.
+ *
+ *   platsch-rle [-o <output>] <dir>/<base>-<width>x<height>-<format>.bin
+ *
+ * Resolution and format are taken from the input file name, the output
+ * defaults to the same name with the extension replaced by .rle. Rows of the
+ * input may be padded, the stride is derived from the file size.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "rle.h"
+
+static int put_count(FILE *out, uint8_t flags, unsigned int count)
+{
+	count--;
+	if (count < RLE_SHORT_MAX)
+		return fputc(flags | count, out) == EOF;
+
+	return fputc(flags | RLE_LONG | count >> 8, out) == EOF ||
+	       fputc(count & 0xff, out) == EOF;
+}
+
+static int encode_row(FILE *out, const uint8_t *row, unsigned int width,
+		      unsigned int cpp)
+{
+	unsigned int x = 0, lit_start = 0, run;
+
+	while (x < width) {
+		/* measure the run starting at x */
+		for (run = 1; x + run < width && run < RLE_LONG_MAX; run++)
+			if (memcmp(row + x * cpp, row + (x + run) * cpp, cpp))
+				break;
+
+		if (run < 2 && x - lit_start < RLE_LONG_MAX) {
+			x++;
+			continue;
+		}
+
+		/* flush pending literal pixels */
+		if (x > lit_start) {
+			if (put_count(out, 0, x - lit_start) ||
+			    fwrite(row + lit_start * cpp, cpp, x - lit_start, out) != x - lit_start)
+				return -EIO;
+		}
+
+		if (run >= 2) {
+			if (put_count(out, RLE_RUN, run) ||
+			    fwrite(row + x * cpp, cpp, 1, out) != 1)
+				return -EIO;
+			x += run;
+		}
+		lit_start = x;
+	}
+
+	if (x > lit_start) {
+		if (put_count(out, 0, x - lit_start) ||
+		    fwrite(row + lit_start * cpp, cpp, x - lit_start, out) != x - lit_start)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	error("Usage:\n"
+	      "%s [-o|--output <file>] <base>-<width>x<height>-<format>.bin\n"
+	      "   [-h|--help]\n",
+	      prog);
+}
+
+static struct option longopts[] =
+{
+	{ "help",   no_argument,       0, 'h' },
+	{ "output", required_argument, 0, 'o' },
+	{ NULL,     0,                 0, 0   }
+};
+
+int main(int argc, char *argv[])
+{
+	const struct platsch_format *format;
+	struct rle_header hdr = { .magic = RLE_MAGIC };
+	char fmt_name[32], *output = NULL, *p;
+	unsigned int width, height, cpp, y;
+	const char *input;
+	size_t stride;
+	const uint8_t *map;
+	struct stat s;
+	off_t in_size;
+	FILE *out;
+	int fd, c, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "ho:", longopts, NULL)) != EOF) {
+		switch (c) {
+		case 'o':
+			output = strdup(optarg);
+			break;
+		case '?':
+			ret = 1;
+			/* FALLTHRU */
+		case 'h':
+			usage(basename(argv[0]));
+			exit(ret);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(basename(argv[0]));
+		exit(1);
+	}
+	input = argv[optind];
+
+	/* <base>-<width>x<height>-<format>.bin, base may contain '-' */
+	p = strrchr(input, '/');
+	p = p ? p + 1 : (char *)input;
+	while ((p = strchr(p, '-'))) {
+		p++;
+		if (sscanf(p, "%ux%u-%31[^.]", &width, &height, fmt_name) == 3)
+			break;
+	}
+	if (!p) {
+		error("Cannot parse resolution and format from %s\n", input);
+		exit(1);
+	}
+
+	format = platsch_format_find(fmt_name);
+	if (!format) {
+		error("Unknown format %s\n", fmt_name);
+		exit(1);
+	}
+	cpp = format->bpp / 8;
+
+	hdr.version = htole32(RLE_VERSION);
+	hdr.width = htole32(width);
+	hdr.height = htole32(height);
+	hdr.format = htole32(format->format);
+
+	if (!output) {
+		output = malloc(strlen(input) + 5);
+		if (!output)
+			exit(1);
+		strcpy(output, input);
+		p = strrchr(output, '.');
+		if (p && !strchr(p, '/'))
+			*p = '\0';
+		strcat(output, ".rle");
+	}
+
+	fd = open(input, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &s) < 0) {
+		error("Failed to open %s: %m\n", input);
+		exit(1);
+	}
+
+	/* e.g. a dump of a dumb buffer, whose rows are padded to its pitch */
+	stride = height ? s.st_size / height : 0;
+	if (!width || stride < (size_t)width * cpp ||
+	    s.st_size != (off_t)stride * height) {
+		error("Size of %s doesn't match %ux%u-%s\n", input, width,
+		      height, format->name);
+		exit(1);
+	}
+
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		error("Failed to mmap %s: %m\n", input);
+		exit(1);
+	}
+
+	out = fopen(output, "wb");
+	if (!out) {
+		error("Failed to open %s: %m\n", output);
+		exit(1);
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		ret = -EIO;
+
+	for (y = 0; y < height && !ret; y++)
+		ret = encode_row(out, map + y * stride, width, cpp);
+
+	if (fclose(out) || ret) {
+		error("Failed to write %s\n", output);
+		unlink(output);
+		exit(1);
+	}
+
+	in_size = s.st_size;
+	if (!stat(output, &s))
+		printf("%s: %lld -> %lld bytes\n", output, (long long)in_size,
+		       (long long)s.st_size);
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <drm_fourcc.h>
+
+#include "libplatsch.h"
+
+/*
+ * Decoder for the "Quite OK Image Format" (https://qoiformat.org), a lossless
+ * format that decodes in a single table driven pass and is several times
+ * faster than PNG.
+ */
+
+#define QOI_MAGIC		"qoif"
+#define QOI_HEADER_SIZE		14
+#define QOI_PADDING_SIZE	8
+
+#define QOI_OP_INDEX	0x00 /* 00xxxxxx */
+#define QOI_OP_DIFF	0x40 /* 01xxxxxx */
+#define QOI_OP_LUMA	0x80 /* 10xxxxxx */
+#define QOI_OP_RUN	0xc0 /* 11xxxxxx */
+#define QOI_OP_RGB	0xfe
+#define QOI_OP_RGBA	0xff
+#define QOI_MASK_2	0xc0
+
+struct qoi_rgba {
+	uint8_t r, g, b, a;
+};
+
+struct qoi_state {
+	const uint8_t *src;
+	const uint8_t *end;
+	struct qoi_rgba px;
+	struct qoi_rgba index[64];
+	unsigned int run;
+};
+
+static inline uint32_t qoi_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline unsigned int qoi_hash(struct qoi_rgba px)
+{
+	return (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+}
+
+/* XRGB8888, blended over black */
+static inline uint32_t qoi_xrgb(struct qoi_rgba px)
+{
+	if (px.a != 255) {
+		px.r = px.r * px.a / 255;
+		px.g = px.g * px.a / 255;
+		px.b = px.b * px.a / 255;
+	}
+
+	return (uint32_t)px.r << 16 | px.g << 8 | px.b;
+}
+
+static int qoi_decode_row(struct qoi_state *st, uint32_t *row, unsigned int width)
+{
+	const uint8_t *s = st->src;
+	struct qoi_rgba px = st->px;
+	unsigned int x = 0;
+	int8_t vg;
+	uint8_t b1;
+
+	while (x < width) {
+		/* runs continue across rows */
+		if (st->run) {
+			for (; st->run && x < width; st->run--)
+				row[x++] = qoi_xrgb(px);
+			continue;
+		}
+
+		if (st->end - s < 5)
+			return -EINVAL;
+
+		b1 = *s++;
+		if (b1 == QOI_OP_RGB) {
+			px.r = s[0];
+			px.g = s[1];
+			px.b = s[2];
+			s += 3;
+		} else if (b1 == QOI_OP_RGBA) {
+			px.r = s[0];
+			px.g = s[1];
+			px.b = s[2];
+			px.a = s[3];
+			s += 4;
+		} else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+			px = st->index[b1];
+		} else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+			px.r += ((b1 >> 4) & 0x03) - 2;
+			px.g += ((b1 >> 2) & 0x03) - 2;
+			px.b += (b1 & 0x03) - 2;
+		} else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+			vg = (b1 & 0x3f) - 32;
+			px.r += vg - 8 + ((*s >> 4) & 0x0f);
+			px.g += vg;
+			px.b += vg - 8 + (*s & 0x0f);
+			s++;
+		} else {
+			/* QOI_OP_RUN, this pixel plus the run */
+			st->run = b1 & 0x3f;
+		}
+
+		st->index[qoi_hash(px)] = px;
+		row[x++] = qoi_xrgb(px);
+	}
+
+	st->src = s;
+	st->px = px;
+
+	return 0;
+}
+
+/*
+ * Decode a QOI image with dev's resolution into dst, which has dev's stride.
+ * QOI is always 8 bit RGB(A), every row is converted into dev's format on the
+ * way from a cached bounce buffer into dst. name is only used for messages.
+ */
+int qoi_image(struct modeset_dev *dev, void *dst, const void *data, size_t size,
+	      const char *name)
+{
+	struct qoi_state st = { .px = { 0, 0, 0, 255 } };
+	const uint8_t *hdr = data;
+	uint32_t *row = NULL;
+	uint32_t y = 0;
+	int ret;
+
+	if (size < QOI_HEADER_SIZE + QOI_PADDING_SIZE) {
+		ret = -EINVAL;
+		error("%s is too short\n", name);
+		goto out;
+	}
+
+	if (memcmp(hdr, QOI_MAGIC, 4) || qoi_be32(hdr + 4) != dev->width ||
+	    qoi_be32(hdr + 8) != dev->height || hdr[12] < 3 || hdr[12] > 4) {
+		ret = -EINVAL;
+		error("%s is no %ux%u QOI image\n", name, dev->width,
+		      dev->height);
+		goto out;
+	}
+
+	row = malloc(dev->width * sizeof(*row));
+	if (!row) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	st.src = hdr + QOI_HEADER_SIZE;
+	st.end = hdr + size;
+
+	for (y = 0; y < dev->height; y++) {
+		ret = qoi_decode_row(&st, row, dev->width);
+		if (ret) {
+			error("Corrupt data in row %u of %s\n", y, name);
+			break;
+		}
+
+		ret = convert_rows((uint8_t *)dst + (size_t)y * dev->stride,
+				   dev->stride, dev->format->format, row, 0,
+				   dev->width, 1, y);
+		if (ret) {
+			error("Cannot convert %s to %s\n", name,
+			      dev->format->name);
+			break;
+		}
+	}
+
+	free(row);
+
+out:
+	/* don't leave uninitialized rows behind */
+	if (y < dev->height)
+		blit_clear((uint8_t *)dst + (size_t)y * dev->stride, dev->stride,
+			   dev->width * dev->format->bpp / 8, dev->height - y);
+
+	return ret;
+}
+
+/* format is ignored, it's there to fit the other raw loaders */
+int qoi_file(struct modeset_dev *dev, void *dst, const char *filename,
+	     const struct platsch_format *format)
+{
+	const void *data;
+	size_t size;
+	int ret;
+
+	ret = map_file(filename, &data, &size, true);
+	if (ret)
+		return ret;
+
+	ret = qoi_image(dev, dst, data, size, filename);
+
+	if (data)
+		munmap((void *)data, size);
+
+	return ret;
+}
@@ -0,0 +1,175 @@
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "libplatsch.h"
+#include "rle.h"
+
+static void fill_pixels(uint8_t *dst, const uint8_t *pixel, unsigned int cpp,
+			unsigned int count)
+{
+	uint32_t p32;
+	uint16_t p16;
+
+	switch (cpp) {
+	case 4:
+		memcpy(&p32, pixel, sizeof(p32));
+		for (; count; count--, dst += 4)
+			memcpy(dst, &p32, sizeof(p32));
+		break;
+	case 2:
+		memcpy(&p16, pixel, sizeof(p16));
+		for (; count; count--, dst += 2)
+			memcpy(dst, &p16, sizeof(p16));
+		break;
+	default:
+		for (; count; count--, dst += cpp)
+			memcpy(dst, pixel, cpp);
+	}
+}
+
+static int rle_decode_row(uint8_t *row, unsigned int width, unsigned int cpp,
+			  const uint8_t **src, const uint8_t *end)
+{
+	const uint8_t *s = *src;
+	unsigned int x = 0, count;
+	uint8_t c;
+
+	while (x < width) {
+		if (s >= end)
+			return -EINVAL;
+
+		c = *s++;
+		count = c & 0x3f;
+		if (c & RLE_LONG) {
+			if (s >= end)
+				return -EINVAL;
+			count = count << 8 | *s++;
+		}
+		count++;
+
+		if (count > width - x)
+			return -EINVAL;
+
+		if (c & RLE_RUN) {
+			if (end - s < cpp)
+				return -EINVAL;
+			fill_pixels(row + x * cpp, s, cpp, count);
+			s += cpp;
+		} else {
+			if (end - s < (size_t)count * cpp)
+				return -EINVAL;
+			memcpy(row + x * cpp, s, count * cpp);
+			s += count * cpp;
+		}
+		x += count;
+	}
+
+	*src = s;
+
+	return 0;
+}
+
+/*
+ * Decode an RLE image with dev's resolution into dst, which has dev's stride.
+ * format is the format of the image, either dev's format or XRGB8888, which
+ * is converted on the way. Every row is decoded into a cached bounce buffer
+ * and streamed into dst, so the write-combined mapping is written exactly
+ * once. name is only used for messages.
+ */
+int rle_image(struct modeset_dev *dev, void *dst, const void *data, size_t size,
+	      const struct platsch_format *format, const char *name)
+{
+	unsigned int cpp = format->bpp / 8;
+	const struct rle_header *hdr = data;
+	const uint8_t *src, *end;
+	uint8_t *row = NULL;
+	uint32_t y = 0;
+	int ret;
+
+	if (size < sizeof(*hdr)) {
+		ret = -EINVAL;
+		error("%s is too short\n", name);
+		goto out;
+	}
+
+	if (memcmp(hdr->magic, RLE_MAGIC, sizeof(hdr->magic)) ||
+	    le32toh(hdr->version) != RLE_VERSION) {
+		ret = -EINVAL;
+		error("%s is no RLE image of version %u\n", name, RLE_VERSION);
+		goto out;
+	}
+
+	if (le32toh(hdr->width) != dev->width ||
+	    le32toh(hdr->height) != dev->height ||
+	    le32toh(hdr->format) != format->format) {
+		ret = -EINVAL;
+		error("%s doesn't match %ux%u-%s\n", name, dev->width,
+		      dev->height, format->name);
+		goto out;
+	}
+
+	row = malloc(dev->width * cpp);
+	if (!row) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	src = (const uint8_t *)(hdr + 1);
+	end = (const uint8_t *)data + size;
+
+	for (y = 0; y < dev->height; y++) {
+		ret = rle_decode_row(row, dev->width, cpp, &src, end);
+		if (ret) {
+			error("Corrupt data in row %u of %s\n", y, name);
+			break;
+		}
+		if (format == dev->format) {
+			blit_rows((uint8_t *)dst + (size_t)y * dev->stride,
+				  dev->stride, row, 0, dev->width * cpp, 1);
+			continue;
+		}
+
+		ret = convert_rows((uint8_t *)dst + (size_t)y * dev->stride,
+				   dev->stride, dev->format->format, row, 0,
+				   dev->width, 1, y);
+		if (ret) {
+			error("Cannot convert %s to %s\n", name,
+			      dev->format->name);
+			break;
+		}
+	}
+
+	free(row);
+
+out:
+	/* don't leave uninitialized rows behind */
+	if (y < dev->height)
+		blit_clear((uint8_t *)dst + (size_t)y * dev->stride, dev->stride,
+			   dev->width * dev->format->bpp / 8, dev->height - y);
+
+	return ret;
+}
+
+int rle_file(struct modeset_dev *dev, void *dst, const char *filename,
+	     const struct platsch_format *format)
+{
+	const void *data;
+	size_t size;
+	int ret;
+
+	ret = map_file(filename, &data, &size, true);
+	if (ret)
+		return ret;
+
+	ret = rle_image(dev, dst, data, size, format, filename);
+
+	if (data)
+		munmap((void *)data, size);
+
+	return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef __RLE_H__
+#define __RLE_H__
+
+#include <stdint.h>
+
+/*
+ * Run-length encoded splash image (<base>-<width>x<height>-<format>.rle)
+ *
+ * The file starts with struct rle_header, whose fields are stored little
+ * endian, followed by the encoded rows. Each
+ * row is encoded on its own and consists of packets that never cross the end
+ * of a row. A packet starts with a control byte:
+ *
+ *   bit 7:    1: run, one pixel follows that is repeated count times
+ *             0: literal, count pixels follow
+ *   bit 6:    1: long count, count - 1 = (bits 5..0 << 8) | next byte
+ *             0: short count, count - 1 = bits 5..0
+ *
+ * Pixels are stored in the image's DRM format, which is little endian too.
+ */
+
+#define RLE_MAGIC		"PRLE"
+#define RLE_VERSION		1
+#define RLE_RUN			0x80
+#define RLE_LONG		0x40
+#define RLE_SHORT_MAX		64
+#define RLE_LONG_MAX		16384
+
+struct rle_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+};
+
+#endif /* __RLE_H__ */
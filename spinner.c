@@ -1,71 +1,431 @@
 #include "libplatsch.h"
 #include "spinner_conf.h"
-#include <cairo.h>
-#include <math.h>
+#include "spinner_control.h"
+#include "spinner_queue.h"
+#include "spinner_render.h"
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 
-typedef struct spinner {
-	cairo_format_t fmt;
-	cairo_surface_t *background_surface;
-	cairo_surface_t *icon_surface;
-	cairo_surface_t *image_surface;
-	cairo_surface_t *drawing_surface;
-	cairo_t *cr_background;
-	cairo_t *cr_drawing;
-	cairo_t *device_cr;
-	int background_height;
-	int background_width;
-	int display_height;
-	int display_width;
-	int icon_height;
-	int icon_width;
-	struct modeset_dev *dev;
-	struct spinner *next;
-} spinner_t;
-
-void on_draw_Sequence_animation(cairo_t *cr, spinner_t *data)
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+static void draw_frame(spinner_t *data)
+{
+	struct modeset_dev *dev = data->dev;
+	drmModeClip clips[SPINNER_MAX_CLIPS];
+	struct modeset_buf *buf;
+	unsigned int n;
+
+	if (data->sprite_cr[0]) {
+		/*
+		 * The primary plane only changes with the status, the icon
+		 * pauses for the frame that flips it.
+		 */
+		if (dev->front_buf >= 0 && spinner_overlay_stale(data, dev->front_buf)) {
+			buf = get_back_buffer(dev);
+			if (!buf)
+				return;
+			n = spinner_render_overlay(data, buf, clips);
+			update_display_damage(dev, clips, n);
+			return;
+		}
+
+		if (!on_draw_sprite(data))
+			return;
+
+		error("Sprite update failed, drawing full frames\n");
+		teardown_sprite(data);
+	}
+
+	buf = get_back_buffer(dev);
+	if (!buf)
+		return;
+
+	n = spinner_render(data, buf, clips);
+	update_display_damage(dev, clips, n);
+}
+
+static volatile sig_atomic_t stats_requested;
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		stats_requested = 1;
+	else
+		stop_requested = 1;
+}
+
+/* No SA_RESTART, so the signals interrupt poll() in run_frames */
+static void setup_signals(void)
+{
+	struct sigaction sa = { .sa_handler = on_signal };
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+}
+
+/*
+ * Write the per connector statistics to path, or stdout if it is empty. The
+ * file is replaced atomically, so a reader never sees half a report.
+ */
+static void dump_stats(spinner_t *spinner_list, const char *path)
+{
+	char tmp[PATH_MAX], name[32];
+	spinner_t *iter;
+	FILE *f = stdout;
+	int ret;
+
+	if (path[0]) {
+		ret = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		if (ret >= sizeof(tmp)) {
+			error("Failed to fit filename into buffer\n");
+			return;
+		}
+		f = fopen(tmp, "w");
+		if (!f) {
+			error("Failed to open %s: %m\n", tmp);
+			return;
+		}
+	}
+
+	for (iter = spinner_list; iter; iter = iter->next) {
+		snprintf(name, sizeof(name), "connector #%u", iter->dev->conn_id);
+		stats_dump(f, name, &iter->stats, iter->sched.dropped);
+	}
+
+	if (f == stdout) {
+		fflush(f);
+		return;
+	}
+
+	if (fclose(f) || rename(tmp, path)) {
+		error("Failed to write %s: %m\n", path);
+		unlink(tmp);
+	}
+}
+
+static void record_flip(spinner_t *data)
+{
+	struct spinner_stats *st = &data->stats;
+	uint64_t vblank = sched_last_vblank(&data->sched);
+
+	if (vblank > st->present_time)
+		hist_record(&st->flip, vblank - st->present_time);
+
+	if (!st->flips)
+		st->first_flip = vblank;
+	st->last_flip = vblank;
+	st->flips++;
+}
+
+/*
+ * Render ahead in a thread per connector. Buffers travel between the threads
+ * through two lock-free queues: free buffers to the worker, rendered frames
+ * back to the presenting thread, which alone talks to DRM. A buffer is either
+ * with the worker (queued, being rendered or rendered) or with the display
+ * (front or pending).
+ */
+struct render_worker {
+	pthread_t thread;
+	struct spsc_queue free;
+	struct spsc_queue ready;
+	bool with_worker[MODESET_MAX_BUFFERS];
+	int wake_fd;		/* eventfd, free buffer or stop */
+	bool stop;
+};
+
+/* eventfd the workers signal rendered frames with */
+static int ready_fd = -1;
+
+static void *render_thread(void *arg)
+{
+	spinner_t *data = arg;
+	struct render_worker *w = data->worker;
+	struct spsc_entry e;
+	uint64_t start, val;
+
+	while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+		if (!spsc_pop(&w->free, &e)) {
+			eventfd_read(w->wake_fd, &val);
+			continue;
+		}
+
+		start = sched_now();
+		e.num_clips = spinner_render(data, &data->dev->bufs[e.buf],
+					     e.clips);
+		hist_record(&data->stats.render, sched_now() - start);
+
+		/* there are never more frames than buffers */
+		spsc_push(&w->ready, &e);
+		eventfd_write(ready_fd, 1);
+	}
+
+	return NULL;
+}
+
+/* Hand all buffers the display doesn't use anymore to the worker */
+static void reclaim_buffers(spinner_t *data)
+{
+	struct render_worker *w = data->worker;
+	struct modeset_dev *dev = data->dev;
+	struct spsc_entry e = { 0 };
+	bool woken = false;
+	int b;
+
+	for (b = 0; b < dev->num_bufs; b++) {
+		if (w->with_worker[b] || b == dev->front_buf || b == dev->pending_buf)
+			continue;
+
+		e.buf = b;
+		spsc_push(&w->free, &e);
+		w->with_worker[b] = true;
+		woken = true;
+	}
+
+	if (woken)
+		eventfd_write(w->wake_fd, 1);
+}
+
+static void present_frame(spinner_t *data)
+{
+	struct render_worker *w = data->worker;
+	struct modeset_dev *dev = data->dev;
+	struct spsc_entry e;
+
+	if (!spsc_pop(&w->ready, &e))
+		return;
+
+	w->with_worker[e.buf] = false;
+	dev->back_buf = e.buf;
+	data->stats.present_time = sched_now();
+	update_display_damage(dev, e.clips, e.num_clips);
+}
+
+/*
+ * Sprite planes are updated while rendering, and a single buffer can't be
+ * rendered while it is shown, so those connectors render inline.
+ */
+static int start_worker(spinner_t *data)
 {
-	static int current_frame;
-	int num_frames = data->icon_width / data->icon_height;
-	int frame_width = data->icon_height;
+	struct render_worker *w;
+	sigset_t set, old;
+	int ret;
 
-	cairo_set_source_surface(cr, data->background_surface, 0, 0);
-	cairo_paint(cr);
+	if (data->sprite_cr[0] || data->dev->num_bufs < 2)
+		return 0;
 
-	cairo_save(cr);
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return -ENOMEM;
 
-	cairo_translate(cr, data->display_width / 2, data->display_height / 2);
+	w->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (w->wake_fd < 0) {
+		ret = -errno;
+		free(w);
+		return ret;
+	}
+	data->worker = w;
+	reclaim_buffers(data);
+
+	/* signals are for the presenting thread, they interrupt its poll() */
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	ret = -pthread_create(&w->thread, NULL, render_thread, data);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (ret) {
+		close(w->wake_fd);
+		free(w);
+		data->worker = NULL;
+	}
 
-	cairo_set_source_surface(cr, data->icon_surface,
-				 -frame_width / 2 - current_frame * frame_width,
-				 -frame_width / 2);
+	return ret;
+}
 
-	cairo_rectangle(cr, -frame_width / 2, -frame_width / 2,
-			frame_width, frame_width);
-	cairo_clip(cr);
-	cairo_paint(cr);
+static void stop_worker(spinner_t *data)
+{
+	struct render_worker *w = data->worker;
+
+	if (!w)
+		return;
 
-	cairo_restore(cr);
+	__atomic_store_n(&w->stop, true, __ATOMIC_RELEASE);
+	eventfd_write(w->wake_fd, 1);
+	pthread_join(w->thread, NULL);
 
-	current_frame = (current_frame + 1) % num_frames;
+	close(w->wake_fd);
+	free(w);
+	data->worker = NULL;
 }
 
-void on_draw_rotation_animation(cairo_t *cr, spinner_t *data)
+/*
+ * Draw frames at their deadlines on all outputs, which may run at different
+ * refresh rates, until each has shown max_frames frames (0 for infinite).
+ * The loop sleeps in poll() until the earliest deadline (timerfd), the next
+ * page flip event or a frame rendered by a worker. With threads, frames are
+ * rendered ahead and only presented here; a frame that isn't ready at its
+ * deadline is presented as soon as it is. Status updates from the control
+ * FIFO are applied at most once per animation frame.
+ */
+static int run_frames(spinner_t *spinner_list, unsigned int fps, int max_frames,
+		      bool threads, const char *stats_path,
+		      const char *control_path)
 {
-	static float angle = 0.0;
-
-	cairo_set_source_surface(cr, data->background_surface, 0, 0);
-	cairo_paint(cr);
-	cairo_save(cr);
-	cairo_translate(cr, data->background_width / 2, data->background_height / 2);
-	cairo_rotate(cr, angle);
-	cairo_translate(cr, -data->icon_width / 2, -data->icon_height / 2);
-	cairo_set_source_surface(cr, data->icon_surface, 0, 0);
-	cairo_paint(cr);
-	cairo_restore(cr);
-	angle += 0.1;
-	if (angle > 2 * M_PI)
-		angle = 0.0;
+	struct spinner_control ctl = { .fd = -1 };
+	struct pollfd pfd[4];
+	struct itimerspec its = { 0 };
+	spinner_t *iter;
+	uint64_t now, start, wakeup, expirations, next_status = 0;
+	bool done;
+	int tfd;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd < 0) {
+		error("Failed to create timer: %m\n");
+		return -errno;
+	}
+
+	pfd[0].fd = display_fd();
+	pfd[0].events = POLLIN;
+	pfd[1].fd = tfd;
+	pfd[1].events = POLLIN;
+
+	ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ready_fd < 0)
+		threads = false;
+	pfd[2].fd = threads ? ready_fd : -1;
+	pfd[2].events = POLLIN;
+
+	if (control_path[0])
+		control_open(&ctl, control_path);
+	pfd[3].fd = ctl.fd;
+	pfd[3].events = POLLIN;
+
+	setup_signals();
+
+	now = sched_now();
+	for (iter = spinner_list; iter; iter = iter->next) {
+		sched_init(&iter->sched, iter->dev, fps, now);
+		if (threads && start_worker(iter))
+			error("Failed to start render thread, rendering inline\n");
+	}
+
+	while (!stop_requested) {
+		if (stats_requested) {
+			stats_requested = 0;
+			dump_stats(spinner_list, stats_path);
+		}
+
+		now = sched_now();
+		wakeup = UINT64_MAX;
+		done = true;
+
+		if (control_pending(&ctl)) {
+			if (now >= next_status) {
+				spinner_set_status(ctl.status_changed ? ctl.status : NULL,
+						   ctl.progress);
+				ctl.status_changed = ctl.progress_changed = false;
+				next_status = now + 1000000000ULL / (fps ? fps : 1);
+			} else {
+				wakeup = next_status;
+			}
+		}
+
+		for (iter = spinner_list; iter; iter = iter->next) {
+			if (sched_flip_done(&iter->sched)) {
+				record_flip(iter);
+				if (iter->worker)
+					reclaim_buffers(iter);
+			}
+
+			if (max_frames && iter->sched.frames >= max_frames)
+				continue;
+			done = false;
+
+			/* the worker's eventfd wakes us up once it's ready */
+			if (iter->worker && spsc_empty(&iter->worker->ready))
+				continue;
+
+			if (sched_begin_frame(&iter->sched, now)) {
+				if (iter->worker) {
+					present_frame(iter);
+				} else {
+					start = sched_now();
+					draw_frame(iter);
+					iter->stats.present_time = sched_now();
+					hist_record(&iter->stats.render,
+						    iter->stats.present_time - start);
+				}
+				sched_end_frame(&iter->sched);
+				if (iter->worker)
+					reclaim_buffers(iter);
+			}
+
+			wakeup = MIN(wakeup, sched_wakeup(&iter->sched));
+		}
+
+		if (done)
+			break;
+
+		/* a zero it_value would disarm the timer */
+		if (wakeup != UINT64_MAX) {
+			wakeup = MAX(wakeup, 1);
+			its.it_value.tv_sec = wakeup / 1000000000;
+			its.it_value.tv_nsec = wakeup % 1000000000;
+		} else {
+			its.it_value.tv_sec = 0;
+			its.it_value.tv_nsec = 0;
+		}
+		timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+
+		if (poll(pfd, 4, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error("Failed to poll: %m\n");
+			break;
+		}
+
+		if ((pfd[1].revents & POLLIN) &&
+		    read(tfd, &expirations, sizeof(expirations)) < 0)
+			debug("Failed to read frame timer: %m\n");
+		if (pfd[0].revents & POLLIN)
+			handle_display_events(0);
+		if (pfd[2].revents & POLLIN)
+			eventfd_read(ready_fd, &expirations);
+		if (pfd[3].revents & POLLIN) {
+			control_read(&ctl);
+			/* like SIGTERM, so the holder isn't started either */
+			if (ctl.stop)
+				stop_requested = 1;
+		}
+	}
+
+	for (iter = spinner_list; iter; iter = iter->next)
+		stop_worker(iter);
+
+	dump_stats(spinner_list, stats_path);
+
+	control_close(&ctl, control_path);
+	if (ready_fd >= 0)
+		close(ready_fd);
+	close(tfd);
+
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -76,13 +436,11 @@ int main(int argc, char *argv[])
 	const char *base = "splash";
 	const char *dir = "/usr/share/platsch";
 	const char *env;
-	int frames;
+	int plane_type;
 	int ret;
-	long elapsed_time;
 
-	spinner_t *spinner_list = NULL, *spinner_node = NULL, *spinner_iter = NULL;
+	spinner_t *spinner_list = NULL, *spinner_node = NULL;
 	struct modeset_dev *iter;
-	struct timeval start, end;
 
 	env = getenv("platsch_directory");
 	if (env)
@@ -99,8 +457,10 @@ int main(int argc, char *argv[])
 	}
 
 	parseConfig(filename, &config);
+	plane_type = sprite_plane_type(config.plane);
+	rotation_setup(&config);
 
-	struct modeset_dev *modeset_list = init();
+	struct modeset_dev *modeset_list = init(config.buffers);
 
 	if (!modeset_list) {
 		fprintf(stderr, "Failed to initialize modeset\n");
@@ -108,100 +468,17 @@ int main(int argc, char *argv[])
 	}
 
 	for (iter = modeset_list; iter; iter = iter->next) {
-		spinner_node = (spinner_t *)malloc(sizeof(spinner_t));
-		if (!spinner_node) {
-			fprintf(stderr, "Failed to allocate memory for spinner_node\n");
-			return EXIT_FAILURE;
-		}
-		memset(spinner_node, 0, sizeof(*spinner_node));
-		printf("spinner_node=%p\n", spinner_node);
-
-		spinner_node->device_cr = cairo_init(iter, dir, base);
-		if (!spinner_node->device_cr)
-			return EXIT_FAILURE;
-
-		cairo_surface_t *surface = cairo_get_target(spinner_node->device_cr);
-
-		if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
-			fprintf(stderr, "Failed to get cairo surface\n");
-			return EXIT_FAILURE;
-		}
-		spinner_node->display_width = cairo_image_surface_get_width(surface);
-		spinner_node->display_height = cairo_image_surface_get_height(surface);
-		spinner_node->fmt = cairo_image_surface_get_format(surface);
-
-		spinner_node->background_surface = cairo_image_surface_create(
-			spinner_node->fmt,
-			spinner_node->display_width,
-			spinner_node->display_height);
-		if (cairo_surface_status(spinner_node->background_surface)
-			!= CAIRO_STATUS_SUCCESS) {
-			fprintf(stderr, "Failed to load splash.png\n");
-			return EXIT_FAILURE;
-		}
-
-		spinner_node->image_surface = cairo_image_surface_create_from_png(config.backdrop);
-		if (cairo_surface_status(spinner_node->image_surface) != CAIRO_STATUS_SUCCESS) {
-			error("Failed to create cairo surface from %s\n", config.backdrop);
+		spinner_node = spinner_create(iter, &config, plane_type, dir, base);
+		if (!spinner_node)
 			return EXIT_FAILURE;
-		}
-
-		int image_width = cairo_image_surface_get_width(spinner_node->image_surface);
-		int image_height = cairo_image_surface_get_height(spinner_node->image_surface);
-		double scale_x = (double)spinner_node->display_width / image_width;
-		double scale_y = (double)spinner_node->display_height / image_height;
-
-		spinner_node->cr_background = cairo_create(spinner_node->background_surface);
-		cairo_scale(spinner_node->cr_background, scale_x, scale_y);
-		cairo_set_source_surface(spinner_node->cr_background,
-			spinner_node->image_surface, 0, 0);
-
-		cairo_paint(spinner_node->cr_background);
-
-		cairo_select_font_face(spinner_node->cr_background, config.text_font,
-				       CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-		cairo_set_font_size(spinner_node->cr_background, (double)config.text_size);
-		cairo_set_source_rgb(spinner_node->cr_background, 0, 0, 0);
-		cairo_move_to(spinner_node->cr_background, config.text_x, config.text_y);
-		cairo_show_text(spinner_node->cr_background, config.text);
-
-		spinner_node->background_width = cairo_image_surface_get_width(
-			spinner_node->background_surface);
-		spinner_node->background_height = cairo_image_surface_get_height(
-			spinner_node->background_surface);
-		printf("spinner_node->background_width=%d, spinner_node->background_height=%d\n",
-		       spinner_node->background_width, spinner_node->background_height);
-
-		spinner_node->icon_surface = cairo_image_surface_create_from_png(config.symbol);
-		if (cairo_surface_status(spinner_node->icon_surface) != CAIRO_STATUS_SUCCESS) {
-			fprintf(stderr, "Failed to load %s\n", config.symbol);
-			return EXIT_FAILURE;
-		}
-		spinner_node->icon_width = cairo_image_surface_get_width(
-			spinner_node->icon_surface);
-		spinner_node->icon_height = cairo_image_surface_get_height(
-			spinner_node->icon_surface);
-		printf("spinner_node->icon_width=%d, spinner_node->icon_height=%d\n",
-		       spinner_node->icon_width, spinner_node->icon_height);
-
-		spinner_node->drawing_surface = cairo_image_surface_create(
-			spinner_node->fmt,
-			spinner_node->display_width,
-			spinner_node->display_height);
-		if (cairo_surface_status(spinner_node->drawing_surface) != CAIRO_STATUS_SUCCESS) {
-			error("Failed to create drawing surface\n");
-			return EXIT_FAILURE;
-		}
-		spinner_node->cr_drawing = cairo_create(spinner_node->drawing_surface);
-
-		cairo_set_source_surface(
-			spinner_node->device_cr,
-			spinner_node->drawing_surface, 0, 0);
-		update_display(iter);
 
 		spinner_node->next = spinner_list;
 		spinner_list = spinner_node;
 	}
+	update_displays();
+	/* the summary includes when the first frame was scanned out */
+	wait_displays();
+	trace_summary();
 
 	if (pid1) {
 		char **initsargv;
@@ -232,35 +509,13 @@ int main(int argc, char *argv[])
 
 drawing:
 	printf("drawing\n");
-	frames = config.frames;
-	if (config.frames == 0)
-		frames = 1;
-
-	while (frames) {
-		gettimeofday(&start, NULL);
-		for (spinner_iter = spinner_list; spinner_iter; spinner_iter = spinner_iter->next) {
-			if (spinner_node->icon_width / spinner_node->icon_height > 2)
-				on_draw_Sequence_animation(spinner_iter->cr_drawing, spinner_iter);
-			else
-				on_draw_rotation_animation(spinner_iter->cr_drawing, spinner_iter);
-
-			cairo_set_source_surface(
-				spinner_iter->device_cr,
-				spinner_iter->drawing_surface, 0, 0);
-			cairo_paint(spinner_iter->device_cr);
-		}
-		gettimeofday(&end, NULL);
-		elapsed_time = (end.tv_sec - start.tv_sec) * 1000000 +
-			(end.tv_usec - start.tv_usec);
+	run_frames(spinner_list, config.fps, config.frames, config.render_thread,
+		   config.stats, config.control);
 
-		long sleep_time = (1000000 / config.fps) - elapsed_time;
-
-		if (sleep_time > 0)
-			usleep(sleep_time);
-
-		if (config.frames > 0)
-			frames--;
-	}
+	/* keep the last frame on screen without the spinner's memory */
+	env = getenv("platsch_holder");
+	if (env && !stop_requested)
+		exec_holder(env);
 
 	return 0;
 }
@@ -0,0 +1,355 @@
+/*
+ * Headless benchmark of the spinner's frame rendering.
+ *
+ *   spinner-bench [-n frames] [-w warmup] [-s WxH] [-p stride] [-f format]
+ *                 [-t type]
+ *
+ * Renders frames of the rotation and sequence animations into a stand-in for
+ * a display whose buffers live in a memfd instead of DRM dumb buffers, so
+ * only rendering is measured, not presentation. Without -s, -f and -t every
+ * combination of 720p, 1080p and 4K, RGB565 and XRGB8888 and both animations
+ * is run. -p sets the pitch of the buffers in bytes, e.g. to match a driver's
+ * alignment, by default rows are aligned to 64 bytes. The backdrop and
+ * symbols are generated into a temporary directory.
+ *
+ * Besides the time per frame, the bytes copied into the display buffer are
+ * reported. Writes to intermediate surfaces aren't included.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "spinner_render.h"
+
+#define SEQUENCE_FRAMES	12
+
+struct bench_size {
+	uint32_t width;
+	uint32_t height;
+};
+
+static const struct bench_size sizes[] = {
+	{ 1280, 720 },
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+static const char *const formats[] = { "RGB565", "XRGB8888" };
+static const char *const types[] = { "rotation", "sequence" };
+
+static char tmpdir[] = "/tmp/spinner-bench-XXXXXX";
+
+static int fake_dev_init(struct modeset_dev *dev, uint32_t width,
+			 uint32_t height, uint32_t stride,
+			 const struct platsch_format *format)
+{
+	uint32_t row = width * format->bpp / 8;
+	unsigned int i;
+	void *map;
+	int fd;
+
+	/* cairo wants rows aligned to 32 bits */
+	if (stride && (stride < row || stride % 4)) {
+		error("Invalid stride %u for %ux%u %s\n", stride, width, height,
+		      format->name);
+		return -EINVAL;
+	}
+
+	memset(dev, 0, sizeof(*dev));
+	dev->width = width;
+	dev->height = height;
+	/* dumb buffers usually come with a pitch aligned like this */
+	dev->stride = stride ?: (row + 63) & ~63U;
+	dev->size = dev->stride * height;
+	dev->format = format;
+	dev->num_bufs = 2;
+	dev->front_buf = -1;
+	dev->back_buf = 0;
+	dev->pending_buf = -1;
+
+	fd = memfd_create("spinner-bench", MFD_CLOEXEC);
+	if (fd < 0) {
+		error("Failed to create memfd: %m\n");
+		return -errno;
+	}
+
+	if (ftruncate(fd, (off_t)dev->size * dev->num_bufs)) {
+		error("Failed to size memfd: %m\n");
+		close(fd);
+		return -errno;
+	}
+
+	map = mmap(NULL, (size_t)dev->size * dev->num_bufs,
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error("Failed to mmap memfd: %m\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < dev->num_bufs; i++)
+		dev->bufs[i].map = (uint8_t *)map + (size_t)i * dev->size;
+
+	return 0;
+}
+
+static void fake_dev_free(struct modeset_dev *dev)
+{
+	munmap(dev->bufs[0].map, (size_t)dev->size * dev->num_bufs);
+}
+
+static int write_png(cairo_surface_t *surface, const char *name, char *path)
+{
+	cairo_status_t status;
+
+	snprintf(path, MAX_LINE_LENGTH, "%s/%s", tmpdir, name);
+	status = cairo_surface_write_to_png(surface, path);
+	cairo_surface_destroy(surface);
+	if (status != CAIRO_STATUS_SUCCESS) {
+		error("Failed to write %s\n", path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static cairo_surface_t *make_backdrop(void)
+{
+	cairo_surface_t *surface;
+	cairo_pattern_t *pattern;
+	cairo_t *cr;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1280, 720);
+	cr = cairo_create(surface);
+	pattern = cairo_pattern_create_linear(0, 0, 1280, 720);
+	cairo_pattern_add_color_stop_rgb(pattern, 0, 0.1, 0.2, 0.4);
+	cairo_pattern_add_color_stop_rgb(pattern, 1, 0.9, 0.6, 0.2);
+	cairo_set_source(cr, pattern);
+	cairo_paint(cr);
+	cairo_pattern_destroy(pattern);
+	cairo_destroy(cr);
+
+	return surface;
+}
+
+static void draw_arc(cairo_t *cr, double cx, double cy, double r, double start)
+{
+	cairo_set_line_width(cr, r / 4);
+	cairo_set_source_rgba(cr, 1, 1, 1, 0.8);
+	cairo_arc(cr, cx, cy, r, start, start + 1.5 * M_PI);
+	cairo_stroke(cr);
+}
+
+static cairo_surface_t *make_rotation_symbol(void)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 128, 128);
+	cr = cairo_create(surface);
+	draw_arc(cr, 64, 64, 48, 0);
+	cairo_destroy(cr);
+
+	return surface;
+}
+
+static cairo_surface_t *make_sequence_symbol(void)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	int i;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					     96 * SEQUENCE_FRAMES, 96);
+	cr = cairo_create(surface);
+	for (i = 0; i < SEQUENCE_FRAMES; i++)
+		draw_arc(cr, 96 * i + 48, 48, 36, 2 * M_PI * i / SEQUENCE_FRAMES);
+	cairo_destroy(cr);
+
+	return surface;
+}
+
+static int bench(const Config *config, uint32_t width, uint32_t height,
+		 uint32_t stride, const struct platsch_format *format,
+		 const char *type, unsigned int frames, unsigned int warmup)
+{
+	struct modeset_dev dev;
+	struct modeset_buf *buf;
+	uint64_t start, elapsed, copied = 0;
+	drmModeClip clips[SPINNER_MAX_CLIPS];
+	unsigned int i, c, n;
+	spinner_t *data;
+	int ret;
+
+	ret = fake_dev_init(&dev, width, height, stride, format);
+	if (ret)
+		return ret;
+
+	data = spinner_create(&dev, config, -1, tmpdir, "spinner-bench");
+	if (!data) {
+		fake_dev_free(&dev);
+		return -EINVAL;
+	}
+
+	start = sched_now();
+	for (i = 0; i < warmup + frames; i++) {
+		if (i == warmup)
+			start = sched_now();
+
+		buf = get_back_buffer(&dev);
+		n = spinner_render(data, buf, clips);
+		for (c = 0; c < n && i >= warmup; c++)
+			copied += (uint64_t)(clips[c].x2 - clips[c].x1) *
+				  (clips[c].y2 - clips[c].y1) * format->bpp / 8;
+
+		/* what a completed page flip does */
+		dev.front_buf = buf - dev.bufs;
+	}
+	elapsed = sched_now() - start;
+
+	printf("%-8s %4ux%-4u %-8s %6u frames %10.1f frames/s %9llu ns/frame "
+	       "%9llu bytes copied/frame\n",
+	       type, width, height, format->name, frames,
+	       frames * 1e9 / (elapsed ? elapsed : 1),
+	       (unsigned long long)(elapsed / frames),
+	       (unsigned long long)(copied / frames));
+
+	spinner_destroy(data);
+	fake_dev_free(&dev);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	error("Usage:\n"
+	      "%s [-n|--frames <n>] [-w|--warmup <n>] [-s|--size <w>x<h>]\n"
+	      "   [-p|--stride <bytes>] [-f|--format <format>]\n"
+	      "   [-t|--type rotation|sequence]\n"
+	      "   [-h|--help]\n",
+	      prog);
+}
+
+static struct option longopts[] =
+{
+	{ "help",   no_argument,       0, 'h' },
+	{ "frames", required_argument, 0, 'n' },
+	{ "warmup", required_argument, 0, 'w' },
+	{ "size",   required_argument, 0, 's' },
+	{ "stride", required_argument, 0, 'p' },
+	{ "format", required_argument, 0, 'f' },
+	{ "type",   required_argument, 0, 't' },
+	{ NULL,     0,                 0, 0   }
+};
+
+int main(int argc, char *argv[])
+{
+	/* sized to fit the configuration */
+	char backdrop[MAX_LINE_LENGTH] = "", rotation[MAX_LINE_LENGTH] = "";
+	char sequence[MAX_LINE_LENGTH] = "";
+	Config config = DEFAULT_CONFIG;
+	struct bench_size size = { 0, 0 };
+	const char *format_name = NULL, *type = NULL;
+	const struct platsch_format *format;
+	unsigned int frames = 600, warmup = 100, stride = 0;
+	unsigned int s, f, t;
+	int c, ret = 0;
+
+	while ((c = getopt_long(argc, argv, "hn:w:s:p:f:t:", longopts, NULL)) != EOF) {
+		switch (c) {
+		case 'n':
+			frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (sscanf(optarg, "%ux%u", &size.width, &size.height) != 2) {
+				usage(basename(argv[0]));
+				exit(1);
+			}
+			break;
+		case 'p':
+			stride = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			format_name = optarg;
+			break;
+		case 't':
+			type = optarg;
+			break;
+		case '?':
+			ret = 1;
+			/* FALLTHRU */
+		case 'h':
+			usage(basename(argv[0]));
+			exit(ret);
+		}
+	}
+
+	if (!frames || (type && strcmp(type, "rotation") && strcmp(type, "sequence"))) {
+		usage(basename(argv[0]));
+		exit(1);
+	}
+
+	if (format_name && !platsch_format_find(format_name)) {
+		error("Unknown format %s\n", format_name);
+		exit(1);
+	}
+
+	if (!mkdtemp(tmpdir)) {
+		error("Failed to create %s: %m\n", tmpdir);
+		exit(1);
+	}
+
+	if (write_png(make_backdrop(), "backdrop.png", backdrop) ||
+	    write_png(make_rotation_symbol(), "rotation.png", rotation) ||
+	    write_png(make_sequence_symbol(), "sequence.png", sequence)) {
+		ret = 1;
+		goto out;
+	}
+
+	strcpy(config.backdrop, backdrop);
+	rotation_setup(&config);
+
+	for (t = 0; t < ARRAY_SIZE(types) && !ret; t++) {
+		if (type && strcmp(type, types[t]))
+			continue;
+
+		strcpy(config.symbol, t ? sequence : rotation);
+
+		for (s = 0; s < ARRAY_SIZE(sizes) && !ret; s++) {
+			if (size.width && s)
+				break;
+
+			for (f = 0; f < ARRAY_SIZE(formats) && !ret; f++) {
+				if (format_name && f)
+					break;
+
+				format = platsch_format_find(format_name ?: formats[f]);
+				if (bench(&config,
+					  size.width ?: sizes[s].width,
+					  size.height ?: sizes[s].height, stride,
+					  format, types[t], frames, warmup))
+					ret = 1;
+			}
+		}
+	}
+
+out:
+	unlink(backdrop);
+	unlink(rotation);
+	unlink(sequence);
+	rmdir(tmpdir);
+
+	return ret;
+}
@@ -48,6 +48,17 @@ int parseConfig(const char *filename, Config *config)
 				config->fps = atoi(value);
 			} else if (strcmp(key, "frames") == 0) {
 				config->frames = atoi(value);
+			} else if (strcmp(key, "buffers") == 0) {
+				config->buffers = atoi(value);
+			} else if (strcmp(key, "render_thread") == 0) {
+				config->render_thread = atoi(value);
+			} else if (strcmp(key, "plane") == 0) {
+				strncpy(config->plane, value, MAX_LINE_LENGTH);
+				config->plane[sizeof(config->plane) - 1] = '\0';
+			} else if (strcmp(key, "rotation_step") == 0) {
+				config->rotation_step = atof(value);
+			} else if (strcmp(key, "rotation_frames") == 0) {
+				config->rotation_frames = atoi(value);
 			} else if (strcmp(key, "text_x") == 0) {
 				config->text_x = atoi(value);
 			} else if (strcmp(key, "text_y") == 0) {
@@ -57,6 +68,23 @@ int parseConfig(const char *filename, Config *config)
 				config->text_font[sizeof(config->text_font) - 1] = '\0';
 			} else if (strcmp(key, "text_size") == 0) {
 				config->text_size = atoi(value);
+			} else if (strcmp(key, "text") == 0) {
+				strncpy(config->text, value, MAX_LINE_LENGTH);
+				config->text[sizeof(config->text) - 1] = '\0';
+			} else if (strcmp(key, "progress_x") == 0) {
+				config->progress_x = atoi(value);
+			} else if (strcmp(key, "progress_y") == 0) {
+				config->progress_y = atoi(value);
+			} else if (strcmp(key, "progress_width") == 0) {
+				config->progress_width = atoi(value);
+			} else if (strcmp(key, "progress_height") == 0) {
+				config->progress_height = atoi(value);
+			} else if (strcmp(key, "control") == 0) {
+				strncpy(config->control, value, MAX_LINE_LENGTH);
+				config->control[sizeof(config->control) - 1] = '\0';
+			} else if (strcmp(key, "stats") == 0) {
+				strncpy(config->stats, value, MAX_LINE_LENGTH);
+				config->stats[sizeof(config->stats) - 1] = '\0';
 			}
 		}
 	}
@@ -15,11 +15,22 @@ typedef struct {
 	char type[MAX_LINE_LENGTH];
 	int fps;
 	int frames;
+	int buffers;
+	int render_thread;
+	char plane[MAX_LINE_LENGTH];
+	double rotation_step;
+	int rotation_frames;
 	int text_x;
 	int text_y;
 	char text_font[MAX_LINE_LENGTH];
 	int text_size;
 	char text[MAX_LINE_LENGTH];
+	int progress_x;
+	int progress_y;
+	int progress_width;
+	int progress_height;
+	char control[MAX_LINE_LENGTH];
+	char stats[MAX_LINE_LENGTH];
 } Config;
 
 int parseConfig(const char *filename, Config *config);
@@ -30,10 +41,21 @@ int parseConfig(const char *filename, Config *config);
 	.type = "Rotation", \
 	.fps = 20, \
 	.frames = 0, \
+	.buffers = 2, \
+	.render_thread = 1, \
+	.plane = "none", \
+	.rotation_step = 0.1, \
+	.rotation_frames = 0, \
 	.text_x = 100, \
 	.text_y = 100, \
 	.text_font = "Sans", \
 	.text_size = 30, \
-	.text = "Now loading..." \
+	.text = "Now loading...", \
+	.progress_x = 100, \
+	.progress_y = 120, \
+	.progress_width = 300, \
+	.progress_height = 12, \
+	.control = "", \
+	.stats = "" \
 }
 #endif
@@ -0,0 +1,92 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+#include "spinner_control.h"
+
+/*
+ * Create the FIFO at path and open it. It is opened for writing, too, so it
+ * never reports end of file when the last writer goes away.
+ */
+int control_open(struct spinner_control *c, const char *path)
+{
+	memset(c, 0, sizeof(*c));
+	c->progress = -1;
+
+	if (mkfifo(path, 0600) && errno != EEXIST) {
+		error("Failed to create %s: %m\n", path);
+		c->fd = -1;
+		return -errno;
+	}
+
+	c->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (c->fd < 0) {
+		error("Failed to open %s: %m\n", path);
+		return -errno;
+	}
+
+	return 0;
+}
+
+void control_close(struct spinner_control *c, const char *path)
+{
+	if (c->fd < 0)
+		return;
+
+	close(c->fd);
+	c->fd = -1;
+	unlink(path);
+}
+
+/* Unknown commands are ignored, a flood of them mustn't flood the log */
+static void control_parse(struct spinner_control *c, char *line)
+{
+	if (!strncmp(line, "progress ", 9)) {
+		c->progress = atoi(line + 9);
+		if (c->progress < 0)
+			c->progress = -1;
+		else if (c->progress > 100)
+			c->progress = 100;
+		c->progress_changed = true;
+	} else if (!strncmp(line, "status", 6) &&
+		   (line[6] == ' ' || line[6] == '\0')) {
+		strncpy(c->status, line[6] ? line + 7 : "", sizeof(c->status) - 1);
+		c->status[sizeof(c->status) - 1] = '\0';
+		c->status_changed = true;
+	} else if (!strcmp(line, "stop")) {
+		c->stop = true;
+	}
+}
+
+/*
+ * Parse what was written to the FIFO, at most CONTROL_READ_MAX bytes per
+ * call so a writer can't keep the main loop from presenting frames. The rest
+ * stays in the FIFO and wakes up the next poll().
+ */
+void control_read(struct spinner_control *c)
+{
+	char buf[CONTROL_READ_MAX];
+	ssize_t len, i;
+
+	len = read(c->fd, buf, sizeof(buf));
+	if (len <= 0)
+		return;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			c->line[c->len] = '\0';
+			if (!c->discard)
+				control_parse(c, c->line);
+			c->len = 0;
+			c->discard = false;
+		} else if (c->len == sizeof(c->line) - 1) {
+			c->discard = true;
+		} else if (!c->discard) {
+			c->line[c->len++] = buf[i];
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef __SPINNER_CONTROL_H__
+#define __SPINNER_CONTROL_H__
+
+#include <stdbool.h>
+
+#include "spinner_conf.h"
+
+/*
+ * Line based control channel on a FIFO, for boot services to report their
+ * progress:
+ *
+ *   progress <percent>	show the progress bar, a negative value hides it
+ *   status <text>	replace the status text
+ *   stop		end the animation
+ *
+ * Updates are coalesced, only the latest status and progress are kept until
+ * the main loop applies them.
+ */
+#define CONTROL_READ_MAX	4096	/* bytes parsed per wakeup */
+
+struct spinner_control {
+	int fd;
+	char line[MAX_LINE_LENGTH + 16];	/* partial line */
+	unsigned int len;
+	bool discard;		/* skipping the rest of an overlong line */
+	char status[MAX_LINE_LENGTH];
+	int progress;
+	bool status_changed;
+	bool progress_changed;
+	bool stop;
+};
+
+int control_open(struct spinner_control *c, const char *path);
+void control_read(struct spinner_control *c);
+void control_close(struct spinner_control *c, const char *path);
+
+static inline bool control_pending(const struct spinner_control *c)
+{
+	return c->status_changed || c->progress_changed;
+}
+
+#endif /* __SPINNER_CONTROL_H__ */
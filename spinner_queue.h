@@ -0,0 +1,61 @@
+#ifndef __SPINNER_QUEUE_H__
+#define __SPINNER_QUEUE_H__
+
+#include <stdbool.h>
+
+#include "libplatsch.h"
+#include "spinner_render.h"
+
+/*
+ * Lock-free single producer, single consumer ring of swapchain buffers. The
+ * producer only writes tail, the consumer only writes head, so one thread may
+ * push while another pops without taking a lock.
+ */
+#define SPSC_SIZE	4	/* power of two, more than MODESET_MAX_BUFFERS */
+
+struct spsc_entry {
+	int buf;		/* index into modeset_dev.bufs */
+	drmModeClip clips[SPINNER_MAX_CLIPS];	/* areas changed by the frame */
+	unsigned int num_clips;
+};
+
+struct spsc_queue {
+	struct spsc_entry entries[SPSC_SIZE];
+	unsigned int head;
+	unsigned int tail;
+};
+
+static inline bool spsc_push(struct spsc_queue *q, const struct spsc_entry *e)
+{
+	unsigned int tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == SPSC_SIZE)
+		return false;
+
+	q->entries[tail % SPSC_SIZE] = *e;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static inline bool spsc_pop(struct spsc_queue *q, struct spsc_entry *e)
+{
+	unsigned int head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	*e = q->entries[head % SPSC_SIZE];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* Only meaningful for the consumer */
+static inline bool spsc_empty(struct spsc_queue *q)
+{
+	return __atomic_load_n(&q->head, __ATOMIC_RELAXED) ==
+	       __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif /* __SPINNER_QUEUE_H__ */
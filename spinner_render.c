@@ -0,0 +1,1031 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spinner_render.h"
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+/* decoded PNGs, shared by all groups for the lifetime of the process */
+static struct {
+	char path[MAX_LINE_LENGTH];
+	cairo_surface_t *surface;
+} assets[4];
+
+static struct spinner_group *groups;
+
+static bool is_sequence(struct spinner_group *g)
+{
+	return g->icon_width / g->icon_height > 2;
+}
+
+static void draw_sequence_icon(cairo_t *cr, struct spinner_group *g, int cx,
+			       int cy, unsigned int frame)
+{
+	int num_frames = g->icon_width / g->icon_height;
+	int frame_width = g->icon_height;
+	int current_frame = frame % num_frames;
+
+	cairo_save(cr);
+
+	cairo_translate(cr, cx, cy);
+
+	cairo_set_source_surface(cr, g->icon_surface,
+				 -frame_width / 2 - current_frame * frame_width,
+				 -frame_width / 2);
+
+	cairo_rectangle(cr, -frame_width / 2, -frame_width / 2,
+			frame_width, frame_width);
+	cairo_clip(cr);
+	cairo_paint(cr);
+
+	cairo_restore(cr);
+}
+
+static void draw_rotation_icon(cairo_t *cr, struct spinner_group *g, double cx,
+			       double cy, double angle)
+{
+	cairo_save(cr);
+	cairo_translate(cr, cx, cy);
+	cairo_rotate(cr, angle);
+	cairo_translate(cr, -g->icon_width / 2, -g->icon_height / 2);
+	cairo_set_source_surface(cr, g->icon_surface, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
+static double rotation_step;
+static int rotation_frames;
+
+void rotation_setup(const Config *config)
+{
+	rotation_step = config->rotation_step;
+	rotation_frames = config->rotation_frames;
+
+	if (rotation_frames <= 0 && rotation_step <= 0)
+		rotation_step = 0.1;
+	if (rotation_frames <= 0)
+		rotation_frames = ceil(2 * M_PI / rotation_step);
+
+	/* evenly spaced, so there's no hitch where a turn wraps around */
+	rotation_step = 2 * M_PI / rotation_frames;
+}
+
+static void free_atlas(struct spinner_atlas *atlas)
+{
+	if (atlas->surface)
+		cairo_surface_destroy(atlas->surface);
+	free(atlas->valid);
+	atlas->surface = NULL;
+	atlas->valid = NULL;
+}
+
+/* cairo's limit for the size of an image surface */
+#define ATLAS_MAX_HEIGHT	32767
+
+/*
+ * Create the rotation atlas for cells covering the screen area cell, with
+ * the symbol centered at cx, cy within a cell. The cells are rendered lazily,
+ * so the first turn costs as much as before. If the atlas can't be created,
+ * e.g. because a large symbol or many frames exceed cairo's size limit, that
+ * is remembered and callers draw every frame directly instead.
+ */
+static int init_atlas(struct spinner_atlas *atlas, cairo_format_t fmt,
+		      drmModeClip cell, double cx, double cy)
+{
+	if ((long)(cell.y2 - cell.y1) * rotation_frames > ATLAS_MAX_HEIGHT) {
+		debug("%d rotation frames of %d rows exceed the atlas size\n",
+		      rotation_frames, cell.y2 - cell.y1);
+		atlas->failed = true;
+		return -E2BIG;
+	}
+
+	atlas->surface = cairo_image_surface_create(fmt, cell.x2 - cell.x1,
+						    (cell.y2 - cell.y1) * rotation_frames);
+	if (cairo_surface_status(atlas->surface) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to create rotation atlas, drawing frames directly\n");
+		free_atlas(atlas);
+		atlas->failed = true;
+		return -ENOMEM;
+	}
+
+	atlas->valid = calloc(rotation_frames, sizeof(*atlas->valid));
+	if (!atlas->valid) {
+		free_atlas(atlas);
+		atlas->failed = true;
+		return -ENOMEM;
+	}
+
+	atlas->cell = cell;
+	atlas->cx = cx;
+	atlas->cy = cy;
+
+	return 0;
+}
+
+/* y offset of the cell of the given animation frame in the atlas */
+static int cell_offset(struct spinner_atlas *atlas, unsigned int frame)
+{
+	return (frame % rotation_frames) * (atlas->cell.y2 - atlas->cell.y1);
+}
+
+/*
+ * Make sure the cell of the given animation frame is rendered and return its
+ * y offset in the atlas.
+ */
+static int rotation_cell(struct spinner_group *g, struct spinner_atlas *atlas,
+			 unsigned int frame)
+{
+	int i = frame % rotation_frames;
+	int width = atlas->cell.x2 - atlas->cell.x1;
+	int height = atlas->cell.y2 - atlas->cell.y1;
+	int y = cell_offset(atlas, frame);
+	cairo_t *cr;
+
+	if (atlas->valid[i])
+		return y;
+
+	cr = cairo_create(atlas->surface);
+	cairo_rectangle(cr, 0, y, width, height);
+	cairo_clip(cr);
+	if (atlas == &g->sprite_atlas) {
+		cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	} else {
+		cairo_set_source_surface(cr, g->background_surface,
+					 -atlas->cell.x1, y - atlas->cell.y1);
+		cairo_paint(cr);
+	}
+	draw_rotation_icon(cr, g, atlas->cx, y + atlas->cy, i * rotation_step);
+	cairo_destroy(cr);
+	cairo_surface_flush(atlas->surface);
+
+	atlas->valid[i] = true;
+
+	return y;
+}
+
+/* Screen area the icon covers in any frame */
+static drmModeClip icon_clip(struct spinner_group *g)
+{
+	drmModeClip clip;
+	int size;
+
+	if (is_sequence(g))
+		size = g->icon_height;
+	else
+		size = ceil(hypot(g->icon_width, g->icon_height));
+
+	clip.x1 = MAX(g->display_width / 2 - size / 2 - 1, 0);
+	clip.y1 = MAX(g->display_height / 2 - size / 2 - 1, 0);
+	clip.x2 = MIN(g->display_width / 2 + size / 2 + 1, g->display_width);
+	clip.y2 = MIN(g->display_height / 2 + size / 2 + 1, g->display_height);
+
+	return clip;
+}
+
+static bool clip_empty(const drmModeClip *c)
+{
+	return c->x2 <= c->x1 || c->y2 <= c->y1;
+}
+
+/* Grow a to also cover b, either may be empty */
+static void clip_union(drmModeClip *a, const drmModeClip *b)
+{
+	if (clip_empty(b))
+		return;
+	if (clip_empty(a)) {
+		*a = *b;
+		return;
+	}
+
+	a->x1 = MIN(a->x1, b->x1);
+	a->y1 = MIN(a->y1, b->y1);
+	a->x2 = MAX(a->x2, b->x2);
+	a->y2 = MAX(a->y2, b->y2);
+}
+
+/*
+ * Composite a sequence frame into the group's drawing surface, unless it is
+ * already there because another connector of the group showed it. Outside
+ * of the icon area the drawing surface always holds the backdrop.
+ */
+static void draw_sequence_frame(struct spinner_group *g, unsigned int frame)
+{
+	int num_frames = g->icon_width / g->icon_height;
+	int i = frame % num_frames;
+	drmModeClip icon = icon_clip(g);
+
+	if (g->drawn_frame == i)
+		return;
+
+	cairo_save(g->cr_drawing);
+	cairo_rectangle(g->cr_drawing, icon.x1, icon.y1, icon.x2 - icon.x1,
+			icon.y2 - icon.y1);
+	cairo_clip(g->cr_drawing);
+	cairo_set_source_surface(g->cr_drawing, g->background_surface, 0, 0);
+	cairo_paint(g->cr_drawing);
+	draw_sequence_icon(g->cr_drawing, g, g->display_width / 2,
+			   g->display_height / 2, frame);
+	cairo_restore(g->cr_drawing);
+	cairo_surface_flush(g->drawing_surface);
+
+	g->drawn_frame = i;
+}
+
+static bool clip_overlaps(const drmModeClip *a, const drmModeClip *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/* Copy the area clip of surface to the same place in cr's target */
+static void copy_area(cairo_t *cr, cairo_surface_t *surface,
+		      const drmModeClip *clip)
+{
+	cairo_save(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_rectangle(cr, clip->x1, clip->y1, clip->x2 - clip->x1,
+			clip->y2 - clip->y1);
+	cairo_clip(cr);
+	cairo_set_source_surface(cr, surface, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
+/*
+ * Without an atlas, rotate the symbol into the group's drawing surface like
+ * a sequence frame, unless it is already there.
+ */
+static void draw_rotation_frame(struct spinner_group *g, unsigned int frame)
+{
+	int i = frame % rotation_frames;
+	drmModeClip icon = icon_clip(g);
+
+	if (g->drawn_frame == i)
+		return;
+
+	cairo_save(g->cr_drawing);
+	cairo_rectangle(g->cr_drawing, icon.x1, icon.y1, icon.x2 - icon.x1,
+			icon.y2 - icon.y1);
+	cairo_clip(g->cr_drawing);
+	cairo_set_source_surface(g->cr_drawing, g->background_surface, 0, 0);
+	cairo_paint(g->cr_drawing);
+	draw_rotation_icon(g->cr_drawing, g, g->display_width / 2,
+			   g->display_height / 2, i * rotation_step);
+	cairo_restore(g->cr_drawing);
+	cairo_surface_flush(g->drawing_surface);
+
+	g->drawn_frame = i;
+}
+
+/*
+ * Check if what frame is copied from is rendered already: the atlas cell, or
+ * the frame in the group's drawing surface. Sprites draw sequence frames and
+ * rotations without an atlas from the symbol directly.
+ */
+static bool frame_ready(struct spinner_group *g, struct spinner_atlas *atlas,
+			unsigned int frame)
+{
+	bool sprite = atlas == &g->sprite_atlas;
+
+	if (is_sequence(g))
+		return sprite ||
+		       g->drawn_frame == frame % (g->icon_width / g->icon_height);
+	if (atlas->surface)
+		return atlas->valid[frame % rotation_frames];
+
+	return sprite || g->drawn_frame == frame % rotation_frames;
+}
+
+static void frame_prepare(struct spinner_group *g, struct spinner_atlas *atlas,
+			  unsigned int frame)
+{
+	if (is_sequence(g))
+		draw_sequence_frame(g, frame);
+	else if (atlas->surface)
+		rotation_cell(g, atlas, frame);
+	else
+		draw_rotation_frame(g, frame);
+}
+
+/*
+ * Return with g->lock held for reading once frame is rendered into the
+ * group's surfaces. Rendering needs the lock exclusively, but copying the
+ * frame into the connectors' buffers then happens for all of them at once.
+ * Another connector may render a different frame between dropping the write
+ * and taking the read lock, so check again.
+ */
+static void frame_lock(struct spinner_group *g, struct spinner_atlas *atlas,
+		       unsigned int frame)
+{
+	for (;;) {
+		pthread_rwlock_rdlock(&g->lock);
+		if (frame_ready(g, atlas, frame))
+			return;
+		pthread_rwlock_unlock(&g->lock);
+
+		pthread_rwlock_wrlock(&g->lock);
+		if (!frame_ready(g, atlas, frame))
+			frame_prepare(g, atlas, frame);
+		pthread_rwlock_unlock(&g->lock);
+	}
+}
+
+/*
+ * The rotation symbol always covers the same area, so a frame is a copy of
+ * its atlas cell. Anything else in clip is only the backdrop. Called with
+ * the frame ready, see frame_lock().
+ */
+static void draw_rotation_damage(spinner_t *data, cairo_t *device_cr,
+				 const drmModeClip *clip)
+{
+	struct spinner_group *g = data->group;
+	struct spinner_atlas *atlas = &g->atlas;
+	drmModeClip icon = icon_clip(g);
+	int y;
+
+	if (!atlas->surface) {
+		copy_area(device_cr, g->drawing_surface, clip);
+		return;
+	}
+
+	if (clip->x1 < icon.x1 || clip->y1 < icon.y1 || clip->x2 > icon.x2 ||
+	    clip->y2 > icon.y2) {
+		cairo_save(device_cr);
+		cairo_rectangle(device_cr, clip->x1, clip->y1, clip->x2 - clip->x1,
+				clip->y2 - clip->y1);
+		cairo_clip(device_cr);
+		cairo_set_source_surface(device_cr, g->background_surface, 0, 0);
+		cairo_paint(device_cr);
+		cairo_restore(device_cr);
+	}
+
+	y = cell_offset(atlas, data->frame);
+	cairo_save(device_cr);
+	cairo_rectangle(device_cr, icon.x1, icon.y1, icon.x2 - icon.x1,
+			icon.y2 - icon.y1);
+	cairo_clip(device_cr);
+	cairo_set_source_surface(device_cr, atlas->surface, icon.x1, icon.y1 - y);
+	cairo_paint(device_cr);
+	cairo_restore(device_cr);
+}
+
+/*
+ * Display area of a rectangle given in backdrop image coordinates, which the
+ * status text and progress bar are placed in, grown by pad pixels.
+ */
+static drmModeClip image_rect(struct spinner_group *g, double x, double y,
+			      double w, double h, int pad)
+{
+	drmModeClip clip;
+
+	clip.x1 = MAX(floor(x * g->scale_x) - pad, 0);
+	clip.y1 = MAX(floor(y * g->scale_y) - pad, 0);
+	clip.x2 = MIN(ceil((x + w) * g->scale_x) + pad, g->display_width);
+	clip.y2 = MIN(ceil((y + h) * g->scale_y) + pad, g->display_height);
+
+	return clip;
+}
+
+static void set_text_font(cairo_t *cr, const Config *config)
+{
+	cairo_select_font_face(cr, config->text_font, CAIRO_FONT_SLANT_NORMAL,
+			       CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, (double)config->text_size);
+}
+
+/* Area the current status text and progress bar cover, may be empty */
+static drmModeClip status_area(struct spinner_group *g, cairo_t *cr)
+{
+	const Config *config = g->config;
+	drmModeClip area = { 0 }, bar;
+	struct glyphs_extents gext;
+	cairo_text_extents_t ext;
+
+	if (g->status[0]) {
+		if (glyphs_text_extents(&g->glyphs, g->status, &gext)) {
+			set_text_font(cr, config);
+			cairo_text_extents(cr, g->status, &ext);
+		} else {
+			/* atlas extents are display pixels, allow for the pen rounding */
+			ext.x_bearing = (gext.x_bearing - 1) / g->scale_x;
+			ext.y_bearing = (gext.y_bearing - 1) / g->scale_y;
+			ext.width = (gext.width + 2) / g->scale_x;
+			ext.height = (gext.height + 2) / g->scale_y;
+			ext.x_advance = (gext.x_advance + 1) / g->scale_x;
+		}
+		area = image_rect(g, config->text_x + MIN(ext.x_bearing, 0),
+				  config->text_y + ext.y_bearing,
+				  MAX(ext.x_bearing + ext.width, ext.x_advance) -
+				  MIN(ext.x_bearing, 0), ext.height, 2);
+	}
+
+	if (g->progress >= 0) {
+		bar = image_rect(g, config->progress_x, config->progress_y,
+				 config->progress_width, config->progress_height, 2);
+		clip_union(&area, &bar);
+	}
+
+	return area;
+}
+
+/*
+ * Redraw the status text and progress bar into the background surface. area
+ * is restored from the plain backdrop first, it must cover the old status.
+ */
+static void draw_overlay(struct spinner_group *g, cairo_t *cr,
+			 const drmModeClip *area)
+{
+	const Config *config = g->config;
+
+	if (clip_empty(area))
+		return;
+
+	copy_area(cr, g->base_surface, area);
+
+	cairo_save(cr);
+	cairo_rectangle(cr, area->x1, area->y1, area->x2 - area->x1,
+			area->y2 - area->y1);
+	cairo_clip(cr);
+	cairo_scale(cr, g->scale_x, g->scale_y);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+
+	if (g->status[0]) {
+		cairo_move_to(cr, config->text_x, config->text_y);
+		if (cairo_show_atlas_text(cr, &g->glyphs, g->status)) {
+			set_text_font(cr, config);
+			cairo_show_text(cr, g->status);
+		}
+	}
+
+	if (g->progress >= 0) {
+		cairo_set_line_width(cr, 1);
+		cairo_rectangle(cr, config->progress_x + 0.5, config->progress_y + 0.5,
+				config->progress_width - 1, config->progress_height - 1);
+		cairo_stroke(cr);
+		cairo_rectangle(cr, config->progress_x, config->progress_y,
+				(double)config->progress_width * g->progress / 100,
+				config->progress_height);
+		cairo_fill(cr);
+	}
+
+	cairo_restore(cr);
+	cairo_surface_flush(g->background_surface);
+}
+
+/*
+ * Update the status text (unless NULL) and progress (-1 hides the bar) of all
+ * displays. Only the area the old and new status cover is redrawn, buffers
+ * pick it up with their next frame.
+ */
+void spinner_set_status(const char *text, int progress)
+{
+	struct spinner_group *g;
+	drmModeClip area, now, icon;
+	cairo_t *cr;
+
+	for (g = groups; g; g = g->next) {
+		pthread_rwlock_wrlock(&g->lock);
+
+		cr = cairo_create(g->background_surface);
+		area = status_area(g, cr);
+		if (text) {
+			strncpy(g->status, text, sizeof(g->status) - 1);
+			g->status[sizeof(g->status) - 1] = '\0';
+		}
+		g->progress = MIN(progress, 100);
+		now = status_area(g, cr);
+		clip_union(&area, &now);
+		draw_overlay(g, cr, &area);
+		cairo_destroy(cr);
+
+		if (clip_empty(&area)) {
+			pthread_rwlock_unlock(&g->lock);
+			continue;
+		}
+
+		/* cached frames that include the status area are outdated */
+		if (g->atlas.valid && clip_overlaps(&area, &g->atlas.cell))
+			memset(g->atlas.valid, 0,
+			       rotation_frames * sizeof(*g->atlas.valid));
+		icon = icon_clip(g);
+		if (clip_overlaps(&area, &icon))
+			g->drawn_frame = -1;
+		copy_area(g->cr_drawing, g->background_surface, &area);
+		cairo_surface_flush(g->drawing_surface);
+
+		clip_union(&g->overlay, &area);
+		/* read without the lock by spinner_overlay_stale() */
+		__atomic_add_fetch(&g->overlay_gen, 1, __ATOMIC_RELAXED);
+
+		pthread_rwlock_unlock(&g->lock);
+	}
+}
+
+/* Whether buffer b of data lacks the latest status update */
+bool spinner_overlay_stale(spinner_t *data, int b)
+{
+	return data->painted[b] &&
+	       data->overlay_gen[b] != __atomic_load_n(&data->group->overlay_gen,
+						       __ATOMIC_RELAXED);
+}
+
+/*
+ * Copy the status area into buffer b if it has an outdated status, adding the
+ * area to clips. Called with the group lock held for reading.
+ */
+static unsigned int copy_overlay(spinner_t *data, unsigned int b,
+				 cairo_surface_t *surface, drmModeClip *clips)
+{
+	struct spinner_group *g = data->group;
+	unsigned int n = 0;
+
+	if (data->painted[b] && data->overlay_gen[b] != g->overlay_gen &&
+	    !clip_empty(&g->overlay)) {
+		copy_area(data->device_cr[b], surface, &g->overlay);
+		clips[n++] = g->overlay;
+	}
+	data->overlay_gen[b] = g->overlay_gen;
+
+	return n;
+}
+
+/*
+ * Render a frame into the back buffer, touching only the icon area of this
+ * frame and of the last frame drawn into the same buffer, plus the status area
+ * if it changed since the buffer was shown. A buffer that was never painted is
+ * drawn completely. Fills clips with up to SPINNER_MAX_CLIPS changed areas and
+ * returns their number.
+ */
+unsigned int spinner_render(spinner_t *data, struct modeset_buf *buf,
+			    drmModeClip *clips)
+{
+	struct spinner_group *g = data->group;
+	unsigned int b = buf - data->dev->bufs;
+	cairo_t *device_cr = data->device_cr[b];
+	drmModeClip icon = icon_clip(g), clip = icon;
+	unsigned int n;
+
+	if (data->painted[b]) {
+		clip_union(&clip, &data->damage[b]);
+	} else {
+		clip.x1 = clip.y1 = 0;
+		clip.x2 = g->display_width;
+		clip.y2 = g->display_height;
+	}
+
+	frame_lock(g, &g->atlas, data->frame);
+	if (!is_sequence(g)) {
+		n = copy_overlay(data, b, g->background_surface, clips);
+		draw_rotation_damage(data, device_cr, &clip);
+	} else {
+		n = copy_overlay(data, b, g->drawing_surface, clips);
+
+		/* copy only the changed area to the dumb buffer */
+		cairo_save(device_cr);
+		cairo_rectangle(device_cr, clip.x1, clip.y1, clip.x2 - clip.x1,
+				clip.y2 - clip.y1);
+		cairo_clip(device_cr);
+		cairo_set_source_surface(device_cr, g->drawing_surface, 0, 0);
+		cairo_paint(device_cr);
+		cairo_restore(device_cr);
+	}
+	pthread_rwlock_unlock(&g->lock);
+	cairo_surface_flush(cairo_get_target(device_cr));
+
+	data->damage[b] = icon;
+	data->painted[b] = true;
+	data->frame++;
+
+	clips[n++] = clip;
+
+	return n;
+}
+
+/*
+ * With a sprite plane the primary plane only shows the background. Bring the
+ * status in buf up to date, painting it completely if it never was.
+ */
+unsigned int spinner_render_overlay(spinner_t *data, struct modeset_buf *buf,
+				    drmModeClip *clips)
+{
+	struct spinner_group *g = data->group;
+	unsigned int b = buf - data->dev->bufs;
+	cairo_t *device_cr = data->device_cr[b];
+	unsigned int n;
+
+	pthread_rwlock_rdlock(&g->lock);
+
+	if (data->painted[b]) {
+		n = copy_overlay(data, b, g->background_surface, clips);
+	} else {
+		cairo_set_source_surface(device_cr, g->background_surface, 0, 0);
+		cairo_paint(device_cr);
+		clips[0].x1 = clips[0].y1 = 0;
+		clips[0].x2 = g->display_width;
+		clips[0].y2 = g->display_height;
+		n = 1;
+		data->painted[b] = true;
+		data->overlay_gen[b] = g->overlay_gen;
+	}
+	pthread_rwlock_unlock(&g->lock);
+	cairo_surface_flush(cairo_get_target(device_cr));
+
+	return n;
+}
+
+/* Map the "plane" config value to a DRM plane type, -1 for none */
+int sprite_plane_type(const char *plane)
+{
+	if (!strcmp(plane, "overlay"))
+		return DRM_PLANE_TYPE_OVERLAY;
+	if (!strcmp(plane, "cursor"))
+		return DRM_PLANE_TYPE_CURSOR;
+	if (strcmp(plane, "none"))
+		error("Unknown plane type %s, not using a sprite plane\n", plane);
+	return -1;
+}
+
+/*
+ * Put the icon on its own overlay or cursor plane, big enough to hold any
+ * rotation of it. The backdrop is then scanned out unchanged from the primary
+ * plane and every frame only touches the small sprite buffer.
+ */
+static int setup_sprite(spinner_t *data, int plane_type, const char *dir,
+			const char *base)
+{
+	struct spinner_group *g = data->group;
+	struct modeset_dev *dev = data->dev;
+	struct modeset_buf *buf;
+	uint32_t size;
+	unsigned int i;
+	int ret;
+
+	if (is_sequence(g))
+		size = g->icon_height;
+	else
+		size = ceil(hypot(g->icon_width, g->icon_height));
+
+	ret = create_sprite(dev, size, size, plane_type);
+	if (ret)
+		return ret;
+
+	pthread_rwlock_wrlock(&g->lock);
+	if (!is_sequence(g) && !g->sprite_atlas.surface && !g->sprite_atlas.failed) {
+		drmModeClip cell = { 0, 0, size, size };
+
+		init_atlas(&g->sprite_atlas, CAIRO_FORMAT_ARGB32, cell,
+			   size / 2, size / 2);
+	}
+	pthread_rwlock_unlock(&g->lock);
+
+	for (i = 0; i < dev->sprite->num_bufs; i++) {
+		buf = get_back_buffer(dev->sprite);
+		data->sprite_cr[buf - dev->sprite->bufs] = cairo_init(dev->sprite, dir, base);
+		if (!data->sprite_cr[buf - dev->sprite->bufs])
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+void teardown_sprite(spinner_t *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < MODESET_MAX_BUFFERS; i++) {
+		if (data->sprite_cr[i]) {
+			cairo_surface_t *surface = cairo_get_target(data->sprite_cr[i]);
+
+			cairo_destroy(data->sprite_cr[i]);
+			cairo_surface_destroy(surface);
+			data->sprite_cr[i] = NULL;
+		}
+	}
+	destroy_sprite(data->dev);
+}
+
+/* Render the icon into the sprite's back buffer and show it centered */
+int on_draw_sprite(spinner_t *data)
+{
+	struct spinner_group *g = data->group;
+	struct modeset_dev *sprite = data->dev->sprite;
+	struct modeset_buf *buf;
+	cairo_t *cr;
+
+	buf = get_back_buffer(sprite);
+	if (!buf)
+		return -EIO;
+	cr = data->sprite_cr[buf - sprite->bufs];
+
+	frame_lock(g, &g->sprite_atlas, data->frame);
+	if (is_sequence(g)) {
+		cairo_save(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cr);
+		cairo_restore(cr);
+		draw_sequence_icon(cr, g, sprite->width / 2, sprite->height / 2,
+				   data->frame);
+	} else {
+		if (g->sprite_atlas.surface) {
+			/* the sprite's contexts use OVER, copy including alpha */
+			cairo_save(cr);
+			cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+			cairo_set_source_surface(cr, g->sprite_atlas.surface, 0,
+						 -cell_offset(&g->sprite_atlas,
+							      data->frame));
+			cairo_paint(cr);
+			cairo_restore(cr);
+		} else {
+			cairo_save(cr);
+			cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+			cairo_paint(cr);
+			cairo_restore(cr);
+			draw_rotation_icon(cr, g, sprite->width / 2, sprite->height / 2,
+					   (data->frame % rotation_frames) * rotation_step);
+		}
+	}
+	pthread_rwlock_unlock(&g->lock);
+	cairo_surface_flush(cairo_get_target(cr));
+	data->frame++;
+
+	return update_sprite(data->dev,
+			     (g->display_width - (int)sprite->width) / 2,
+			     (g->display_height - (int)sprite->height) / 2);
+}
+
+/* Decode path once, later callers get another reference to the same surface */
+static cairo_surface_t *load_asset(const char *path, const char *dir,
+				   const char *base)
+{
+	cairo_surface_t *surface;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(assets) && assets[i].surface; i++)
+		if (!strcmp(assets[i].path, path))
+			return cairo_surface_reference(assets[i].surface);
+
+	surface = cairo_load_png(path, dir, base);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+	    i == ARRAY_SIZE(assets) || strlen(path) >= sizeof(assets[i].path))
+		return surface;
+
+	strcpy(assets[i].path, path);
+	assets[i].surface = cairo_surface_reference(surface);
+
+	return surface;
+}
+
+static void group_put(struct spinner_group *g)
+{
+	struct spinner_group **p;
+
+	if (--g->users)
+		return;
+
+	for (p = &groups; *p; p = &(*p)->next) {
+		if (*p == g) {
+			*p = g->next;
+			break;
+		}
+	}
+
+	pthread_rwlock_destroy(&g->lock);
+	free_atlas(&g->atlas);
+	free_atlas(&g->sprite_atlas);
+	if (g->cr_drawing)
+		cairo_destroy(g->cr_drawing);
+	if (g->drawing_surface)
+		cairo_surface_destroy(g->drawing_surface);
+	if (g->icon_surface)
+		cairo_surface_destroy(g->icon_surface);
+	if (g->background_surface)
+		cairo_surface_destroy(g->background_surface);
+	if (g->base_surface)
+		cairo_surface_destroy(g->base_surface);
+	glyphs_close(&g->glyphs);
+	free(g);
+}
+
+static int group_init(struct spinner_group *g, const Config *config,
+		      const char *dir, const char *base)
+{
+	cairo_surface_t *image;
+	cairo_t *cr;
+
+	drmModeClip area;
+
+	g->config = config;
+	g->drawn_frame = -1;
+	g->progress = -1;
+	strcpy(g->status, config->text);
+
+	g->base_surface = cairo_image_surface_create(g->fmt, g->display_width,
+						     g->display_height);
+	g->background_surface = cairo_image_surface_create(g->fmt,
+							   g->display_width,
+							   g->display_height);
+	if (cairo_surface_status(g->base_surface) != CAIRO_STATUS_SUCCESS ||
+	    cairo_surface_status(g->background_surface) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to create backdrop surface\n");
+		return -ENOMEM;
+	}
+
+	image = load_asset(config->backdrop, dir, base);
+	if (cairo_surface_status(image) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to create cairo surface from %s\n", config->backdrop);
+		cairo_surface_destroy(image);
+		return -ENOENT;
+	}
+
+	/* the status is placed in image coordinates, like the backdrop is */
+	g->scale_x = (double)g->display_width / cairo_image_surface_get_width(image);
+	g->scale_y = (double)g->display_height / cairo_image_surface_get_height(image);
+
+	/*
+	 * Without an atlas, the first text loads the font through fontconfig.
+	 * Atlas glyphs are drawn unscaled, so take the one for the text size on
+	 * the display.
+	 */
+	glyphs_open(&g->glyphs, dir, base, config->text_font,
+		    lround(config->text_size * g->scale_y));
+
+	cr = cairo_create(g->base_surface);
+	cairo_scale(cr, g->scale_x, g->scale_y);
+	cairo_set_source_surface(cr, image, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	cairo_surface_destroy(image);
+	cairo_surface_flush(g->base_surface);
+
+	cr = cairo_create(g->background_surface);
+	cairo_set_source_surface(cr, g->base_surface, 0, 0);
+	cairo_paint(cr);
+	area = status_area(g, cr);
+	draw_overlay(g, cr, &area);
+	cairo_destroy(cr);
+
+	g->icon_surface = load_asset(config->symbol, dir, base);
+	if (cairo_surface_status(g->icon_surface) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to load %s\n", config->symbol);
+		return -ENOENT;
+	}
+	g->icon_width = cairo_image_surface_get_width(g->icon_surface);
+	g->icon_height = cairo_image_surface_get_height(g->icon_surface);
+
+	g->drawing_surface = cairo_image_surface_create(g->fmt, g->display_width,
+							g->display_height);
+	if (cairo_surface_status(g->drawing_surface) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to create drawing surface\n");
+		return -ENOMEM;
+	}
+	g->cr_drawing = cairo_create(g->drawing_surface);
+	cairo_set_source_surface(g->cr_drawing, g->background_surface, 0, 0);
+	cairo_paint(g->cr_drawing);
+
+	if (!is_sequence(g)) {
+		drmModeClip icon = icon_clip(g);
+
+		init_atlas(&g->atlas, g->fmt, icon,
+			   g->display_width / 2 - icon.x1,
+			   g->display_height / 2 - icon.y1);
+	}
+
+	return 0;
+}
+
+/* Find or create the group for displays of dev's size and format */
+static struct spinner_group *group_get(struct modeset_dev *dev,
+				       cairo_format_t fmt, const Config *config,
+				       const char *dir, const char *base)
+{
+	struct spinner_group *g;
+
+	for (g = groups; g; g = g->next) {
+		if (g->display_width == dev->width &&
+		    g->display_height == dev->height &&
+		    g->format == dev->format && g->fmt == fmt) {
+			g->users++;
+			return g;
+		}
+	}
+
+	g = calloc(1, sizeof(*g));
+	if (!g) {
+		error("Failed to allocate memory for spinner group\n");
+		return NULL;
+	}
+	g->format = dev->format;
+	g->fmt = fmt;
+	g->display_width = dev->width;
+	g->display_height = dev->height;
+	g->users = 1;
+	pthread_rwlock_init(&g->lock, NULL);
+
+	if (group_init(g, config, dir, base)) {
+		group_put(g);
+		return NULL;
+	}
+
+	g->next = groups;
+	groups = g;
+
+	return g;
+}
+
+void spinner_destroy(spinner_t *data)
+{
+	unsigned int i;
+
+	if (data->sprite_cr[0])
+		teardown_sprite(data);
+
+	for (i = 0; i < MODESET_MAX_BUFFERS; i++) {
+		if (data->device_cr[i]) {
+			cairo_surface_t *surface = cairo_get_target(data->device_cr[i]);
+
+			cairo_destroy(data->device_cr[i]);
+			cairo_surface_destroy(surface);
+		}
+	}
+
+	if (data->group)
+		group_put(data->group);
+	free(data);
+}
+
+/*
+ * Set up the spinner for dev: create a cairo context per swapchain buffer,
+ * join the group of displays with the same size and format and paint the
+ * backdrop into the back buffer. plane_type is a DRM_PLANE_TYPE_* for the
+ * symbol's sprite plane, or -1.
+ */
+spinner_t *spinner_create(struct modeset_dev *dev, const Config *config,
+			  int plane_type, const char *dir, const char *base)
+{
+	struct modeset_buf *buf;
+	cairo_surface_t *surface;
+	cairo_t *device_cr;
+	spinner_t *data;
+	unsigned int i;
+
+	data = calloc(1, sizeof(*data));
+	if (!data) {
+		error("Failed to allocate memory for spinner\n");
+		return NULL;
+	}
+	data->dev = dev;
+
+	/* one cairo context per swapchain buffer, cairo_init() uses the back buffer */
+	for (i = 0; i < dev->num_bufs; i++) {
+		buf = get_back_buffer(dev);
+		data->device_cr[buf - dev->bufs] = cairo_init(dev, dir, base);
+		if (!data->device_cr[buf - dev->bufs])
+			goto err;
+		/* frames are copied, not blended over stale buffer contents */
+		cairo_set_operator(data->device_cr[buf - dev->bufs],
+				   CAIRO_OPERATOR_SOURCE);
+	}
+
+	surface = cairo_get_target(data->device_cr[0]);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		error("Failed to get cairo surface\n");
+		goto err;
+	}
+
+	data->group = group_get(dev, cairo_image_surface_get_format(surface),
+				config, dir, base);
+	if (!data->group)
+		goto err;
+
+	if (plane_type >= 0 && setup_sprite(data, plane_type, dir, base)) {
+		error("Failed to set up sprite plane, drawing full frames\n");
+		teardown_sprite(data);
+	}
+
+	/*
+	 * Dumb buffers aren't cleared, show the backdrop until the first
+	 * frame. With a sprite plane this is all the primary plane shows.
+	 */
+	buf = get_back_buffer(dev);
+	device_cr = data->device_cr[buf - dev->bufs];
+
+	cairo_set_source_surface(device_cr, data->group->background_surface, 0, 0);
+	cairo_paint(device_cr);
+	cairo_surface_flush(cairo_get_target(device_cr));
+	data->painted[buf - dev->bufs] = true;
+	data->overlay_gen[buf - dev->bufs] = data->group->overlay_gen;
+
+	return data;
+
+err:
+	spinner_destroy(data);
+	return NULL;
+}
@@ -0,0 +1,98 @@
+#ifndef __SPINNER_RENDER_H__
+#define __SPINNER_RENDER_H__
+
+#include <cairo.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "glyphs.h"
+#include "libplatsch.h"
+#include "spinner_conf.h"
+#include "spinner_sched.h"
+#include "spinner_stats.h"
+
+/* a frame changes the icon area and possibly the status area */
+#define SPINNER_MAX_CLIPS	2
+
+/*
+ * Rotation frames rendered once, stacked vertically. Cells either hold the
+ * symbol over the backdrop or, for a sprite plane, on transparent.
+ */
+struct spinner_atlas {
+	cairo_surface_t *surface;
+	bool *valid;
+	drmModeClip cell;	/* screen area of a cell, if not for a sprite */
+	double cx;		/* center of the symbol within a cell */
+	double cy;
+	bool failed;		/* too large, frames are drawn directly */
+};
+
+/*
+ * Everything that only depends on the size and format of a display. It is
+ * shared by all connectors showing the same, so every animation frame is
+ * rendered once per group and only copied to each connector's buffers.
+ */
+struct spinner_group {
+	const struct platsch_format *format;
+	const Config *config;
+	cairo_format_t fmt;
+	cairo_surface_t *base_surface;		/* scaled backdrop image */
+	cairo_surface_t *background_surface;	/* with status text and progress */
+	double scale_x;		/* from backdrop image to display */
+	double scale_y;
+	struct glyphs glyphs;	/* baked text_font at text_size, if there is one */
+	char status[MAX_LINE_LENGTH];
+	int progress;		/* percent, -1 for no progress bar */
+	drmModeClip overlay;	/* area the status ever covered, may be empty */
+	unsigned int overlay_gen;	/* bumped on every status update */
+	cairo_surface_t *icon_surface;
+	cairo_surface_t *drawing_surface;
+	cairo_t *cr_drawing;
+	int drawn_frame;	/* sequence frame in drawing_surface, -1 if none */
+	struct spinner_atlas atlas;
+	struct spinner_atlas sprite_atlas;
+	int display_height;
+	int display_width;
+	int icon_height;
+	int icon_width;
+	/*
+	 * Connectors of a group may render from different threads. Rendering
+	 * into the shared surfaces takes the lock for writing, copying from
+	 * them for reading.
+	 */
+	pthread_rwlock_t lock;
+	unsigned int users;
+	struct spinner_group *next;
+};
+
+typedef struct spinner {
+	struct spinner_group *group;
+	cairo_t *device_cr[MODESET_MAX_BUFFERS];
+	cairo_t *sprite_cr[MODESET_MAX_BUFFERS];
+	/* icon area last drawn into each swapchain buffer */
+	drmModeClip damage[MODESET_MAX_BUFFERS];
+	bool painted[MODESET_MAX_BUFFERS];
+	unsigned int overlay_gen[MODESET_MAX_BUFFERS];	/* status shown in each */
+	unsigned int frame;	/* animation frame shown next */
+	struct sched_output sched;
+	struct spinner_stats stats;
+	struct render_worker *worker;	/* renders ahead, NULL if inline */
+	struct modeset_dev *dev;
+	struct spinner *next;
+} spinner_t;
+
+void rotation_setup(const Config *config);
+int sprite_plane_type(const char *plane);
+spinner_t *spinner_create(struct modeset_dev *dev, const Config *config,
+			  int plane_type, const char *dir, const char *base);
+unsigned int spinner_render(spinner_t *data, struct modeset_buf *buf,
+			    drmModeClip *clips);
+bool spinner_overlay_stale(spinner_t *data, int b);
+unsigned int spinner_render_overlay(spinner_t *data, struct modeset_buf *buf,
+				    drmModeClip *clips);
+void spinner_set_status(const char *text, int progress);
+void spinner_destroy(spinner_t *data);
+int on_draw_sprite(spinner_t *data);
+void teardown_sprite(spinner_t *data);
+
+#endif /* __SPINNER_RENDER_H__ */
@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "spinner_sched.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+uint64_t sched_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* page flip timestamps are CLOCK_MONOTONIC */
+uint64_t sched_last_vblank(const struct sched_output *o)
+{
+	const struct timeval *tv = &o->dev->flip_time;
+
+	return tv->tv_sec * NSEC_PER_SEC + tv->tv_usec * 1000ULL;
+}
+
+static uint64_t mode_period_ns(const drmModeModeInfo *mode)
+{
+	uint64_t pixels = (uint64_t)mode->htotal * mode->vtotal;
+
+	if (mode->clock && pixels)
+		return pixels * 1000000ULL / mode->clock;
+	if (mode->vrefresh)
+		return NSEC_PER_SEC / mode->vrefresh;
+
+	return NSEC_PER_SEC / 60;
+}
+
+void sched_init(struct sched_output *o, struct modeset_dev *dev,
+		unsigned int fps, uint64_t now)
+{
+	o->dev = dev;
+	o->period_ns = mode_period_ns(&dev->mode);
+	o->interval_ns = NSEC_PER_SEC / (fps ? fps : 1);
+	o->next_frame = now;
+	o->target_vblank = 0;
+	o->pending = false;
+	o->frames = 0;
+	o->dropped = 0;
+}
+
+/* The first vblank at or after t, assuming the grid of the last flip */
+static uint64_t vblank_after(const struct sched_output *o, uint64_t t)
+{
+	uint64_t v = sched_last_vblank(o);
+
+	if (!v || !o->period_ns)
+		return t;
+	if (v >= t)
+		return v;
+
+	return v + (t - v + o->period_ns - 1) / o->period_ns * o->period_ns;
+}
+
+/*
+ * When rendering of the next frame should start: one refresh period ahead of
+ * the vblank it is meant for, so the flip can be queued in time. UINT64_MAX
+ * while a flip is pending, the page flip event wakes the loop up then.
+ */
+uint64_t sched_wakeup(const struct sched_output *o)
+{
+	uint64_t v;
+
+	if (o->pending)
+		return UINT64_MAX;
+
+	v = vblank_after(o, o->next_frame);
+
+	return v > o->period_ns ? v - o->period_ns : 0;
+}
+
+/*
+ * Returns true if the next frame should be rendered now. Frames whose time
+ * has passed completely are skipped and counted as dropped, so a stall
+ * doesn't make the animation race to catch up.
+ */
+bool sched_begin_frame(struct sched_output *o, uint64_t now)
+{
+	uint64_t late;
+
+	if (o->pending || now < sched_wakeup(o))
+		return false;
+
+	if (now > o->next_frame + o->interval_ns) {
+		late = (now - o->next_frame) / o->interval_ns;
+		o->dropped += late;
+		o->next_frame += late * o->interval_ns;
+	}
+
+	o->target_vblank = vblank_after(o, o->next_frame);
+
+	return true;
+}
+
+/* Call after the frame was handed to the display */
+void sched_end_frame(struct sched_output *o)
+{
+	struct modeset_dev *dev = o->dev;
+
+	o->frames++;
+	o->next_frame += o->interval_ns;
+	o->pending = dev->pending_buf >= 0 ||
+		     (dev->sprite && dev->sprite->pending_buf >= 0);
+}
+
+/*
+ * Check whether the pending flip completed, counting the frame as dropped if
+ * it missed its vblank by more than half a refresh period.
+ */
+bool sched_flip_done(struct sched_output *o)
+{
+	struct modeset_dev *dev = o->dev;
+
+	if (!o->pending || dev->pending_buf >= 0 ||
+	    (dev->sprite && dev->sprite->pending_buf >= 0))
+		return false;
+
+	o->pending = false;
+	if (o->target_vblank &&
+	    sched_last_vblank(o) > o->target_vblank + o->period_ns / 2)
+		o->dropped++;
+
+	return true;
+}
@@ -0,0 +1,34 @@
+#ifndef __SPINNER_SCHED_H__
+#define __SPINNER_SCHED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libplatsch.h"
+
+/*
+ * Frame pacing for one output. Frames are due at absolute CLOCK_MONOTONIC
+ * deadlines derived from the configured fps and are presented on the vblank
+ * grid reported by page flip events.
+ */
+struct sched_output {
+	struct modeset_dev *dev;
+	uint64_t period_ns;	/* refresh period of the mode */
+	uint64_t interval_ns;	/* time between animation frames */
+	uint64_t next_frame;	/* ideal time of the next frame */
+	uint64_t target_vblank;	/* vblank the pending frame should hit */
+	bool pending;		/* waiting for a page flip */
+	unsigned int frames;	/* frames presented */
+	unsigned int dropped;	/* frames skipped or shown late */
+};
+
+uint64_t sched_now(void);
+uint64_t sched_last_vblank(const struct sched_output *o);
+void sched_init(struct sched_output *o, struct modeset_dev *dev,
+		unsigned int fps, uint64_t now);
+uint64_t sched_wakeup(const struct sched_output *o);
+bool sched_begin_frame(struct sched_output *o, uint64_t now);
+void sched_end_frame(struct sched_output *o);
+bool sched_flip_done(struct sched_output *o);
+
+#endif /* __SPINNER_SCHED_H__ */
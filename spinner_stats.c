@@ -0,0 +1,99 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "spinner_stats.h"
+
+static unsigned int hist_index(uint32_t v)
+{
+	unsigned int e;
+
+	if (v < HIST_SUB)
+		return v;
+
+	e = 31 - __builtin_clz(v);
+
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+	       ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* lowest value that falls into bucket i */
+static uint64_t hist_value(unsigned int i)
+{
+	unsigned int e;
+
+	if (i < HIST_SUB)
+		return i;
+
+	e = i / HIST_SUB + HIST_SUB_BITS - 1;
+
+	return (uint64_t)(HIST_SUB + i % HIST_SUB) << (e - HIST_SUB_BITS);
+}
+
+void hist_record(struct hist *h, uint64_t ns)
+{
+	uint64_t us = ns / 1000, max;
+
+	if (us > UINT32_MAX)
+		us = UINT32_MAX;
+
+	__atomic_fetch_add(&h->count[hist_index(us)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (us > max &&
+	       !__atomic_compare_exchange_n(&h->max, &max, us, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static uint64_t hist_percentile(const struct hist *h, uint64_t total,
+				unsigned int permille)
+{
+	uint64_t rank = (total * permille + 999) / 1000, seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += __atomic_load_n(&h->count[i], __ATOMIC_RELAXED);
+		if (seen >= rank && seen)
+			return hist_value(i);
+	}
+
+	return 0;
+}
+
+static void hist_dump(FILE *f, const char *what, const struct hist *h)
+{
+	uint64_t total = __atomic_load_n(&h->total, __ATOMIC_RELAXED);
+
+	if (!total) {
+		fprintf(f, "  %-6s no samples\n", what);
+		return;
+	}
+
+	fprintf(f, "  %-6s n=%llu mean=%lluus p50=%lluus p90=%lluus p99=%lluus "
+		"p99.9=%lluus max=%lluus\n", what,
+		(unsigned long long)total,
+		(unsigned long long)(__atomic_load_n(&h->sum, __ATOMIC_RELAXED) / total),
+		(unsigned long long)hist_percentile(h, total, 500),
+		(unsigned long long)hist_percentile(h, total, 900),
+		(unsigned long long)hist_percentile(h, total, 990),
+		(unsigned long long)hist_percentile(h, total, 999),
+		(unsigned long long)__atomic_load_n(&h->max, __ATOMIC_RELAXED));
+}
+
+void stats_dump(FILE *f, const char *name, const struct spinner_stats *st,
+		unsigned int dropped)
+{
+	uint64_t span = st->last_flip - st->first_flip;
+	double fps = 0;
+
+	if (st->flips > 1 && span)
+		fps = (st->flips - 1) * 1e9 / span;
+
+	fprintf(f, "%s: %u flips, %u dropped, %.2f fps\n", name, st->flips,
+		dropped, fps);
+	hist_dump(f, "render", &st->render);
+	hist_dump(f, "flip", &st->flip);
+}
@@ -0,0 +1,37 @@
+#ifndef __SPINNER_STATS_H__
+#define __SPINNER_STATS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear latency histogram in microseconds: exact below HIST_SUB, above
+ * that every power of two is split into HIST_SUB buckets, so any value is
+ * off by at most 1/HIST_SUB. Counters are only ever incremented atomically,
+ * a report can be taken at any time without stopping the writer.
+ */
+#define HIST_SUB_BITS	3
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint32_t count[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct spinner_stats {
+	struct hist render;	/* start of rendering to handing the frame over */
+	struct hist flip;	/* handing the frame over to its page flip */
+	uint64_t present_time;	/* when the pending frame was handed over */
+	uint64_t first_flip;
+	uint64_t last_flip;
+	uint32_t flips;
+};
+
+void hist_record(struct hist *h, uint64_t ns);
+void stats_dump(FILE *f, const char *name, const struct spinner_stats *st,
+		unsigned int dropped);
+
+#endif /* __SPINNER_STATS_H__ */
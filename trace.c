@@ -0,0 +1,188 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libplatsch.h"
+
+/*
+ * Boot phase timing. Every phase is logged to /dev/kmsg and the ftrace
+ * marker as it ends, so it lines up with kernel boot traces, and the slowest
+ * connector's time per phase goes into a one-line summary.
+ */
+
+#define NSEC_PER_SEC	1000000000ULL
+#define NSEC_PER_USEC	1000ULL
+#define NSEC_PER_MSEC	1000000ULL
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+static const char *const phase_names[TRACE_PHASES] = {
+	[TRACE_DISCOVERY] = "discovery",
+	[TRACE_PREPARE] = "prepare",
+	[TRACE_FB] = "fb",
+	[TRACE_DETECT] = "detect",
+	[TRACE_DECODE] = "decode",
+	[TRACE_TEXT] = "text",
+	[TRACE_MODESET] = "modeset",
+	[TRACE_PRESENT] = "present",
+};
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int kmsg_fd = -1;
+static int marker_fd = -1;
+static uint64_t trace_start;
+static uint64_t trace_max[TRACE_PHASES];
+static uint64_t trace_end_time[TRACE_PHASES];
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Tracing is best effort, there is nowhere to report a failed write to */
+static void trace_write(int fd, const char *line, size_t len)
+{
+	if (write(fd, line, len) < 0)
+		return;
+}
+
+/* platsch_trace=0 disables the kmsg and ftrace output */
+static void trace_open(void)
+{
+	const char *env = getenv("platsch_trace");
+
+	if (env && !strcmp(env, "0"))
+		return;
+
+	kmsg_fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+	marker_fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+	if (marker_fd < 0)
+		marker_fd = open("/sys/kernel/debug/tracing/trace_marker",
+				 O_WRONLY | O_CLOEXEC);
+}
+
+/* CLOCK_MONOTONIC in ns, the first call marks the start of platsch */
+uint64_t trace_now(void)
+{
+	uint64_t now = clock_ns(CLOCK_MONOTONIC), zero = 0;
+
+	__atomic_compare_exchange_n(&trace_start, &zero, now, false,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+	return now;
+}
+
+/*
+ * Record that phase began at start and ended at end, both CLOCK_MONOTONIC
+ * like trace_now(). end may lie in the past, e.g. the vblank timestamp of a
+ * page flip event.
+ */
+void trace_phase_end(enum trace_phase phase, uint32_t conn_id, uint64_t start,
+		     uint64_t end)
+{
+	uint64_t now = trace_now(), boot = clock_ns(CLOCK_BOOTTIME);
+	uint64_t dur;
+	char line[160];
+	int len;
+
+	if (end < start)
+		end = start;
+	if (end > now)
+		end = now;
+	dur = end - start;
+	/* CLOCK_BOOTTIME only differs by the time spent in suspend */
+	boot -= now - end;
+
+	pthread_once(&trace_once, trace_open);
+
+	pthread_mutex_lock(&trace_lock);
+	if (dur > trace_max[phase])
+		trace_max[phase] = dur;
+	if (end > trace_end_time[phase])
+		trace_end_time[phase] = end;
+	pthread_mutex_unlock(&trace_lock);
+
+	if (kmsg_fd >= 0) {
+		len = snprintf(line, sizeof(line),
+			       "<6>platsch: %s connector=%u %llu us, monotonic %llu.%06llu boottime %llu.%06llu\n",
+			       phase_names[phase], conn_id,
+			       (unsigned long long)(dur / NSEC_PER_USEC),
+			       (unsigned long long)(end / NSEC_PER_SEC),
+			       (unsigned long long)(end % NSEC_PER_SEC / NSEC_PER_USEC),
+			       (unsigned long long)(boot / NSEC_PER_SEC),
+			       (unsigned long long)(boot % NSEC_PER_SEC / NSEC_PER_USEC));
+		trace_write(kmsg_fd, line, MIN(len, (int)sizeof(line) - 1));
+	}
+
+	/* ftrace stamps the marker itself */
+	if (marker_fd >= 0) {
+		len = snprintf(line, sizeof(line), "platsch: %s connector=%u %llu us\n",
+			       phase_names[phase], conn_id,
+			       (unsigned long long)(dur / NSEC_PER_USEC));
+		trace_write(marker_fd, line, MIN(len, (int)sizeof(line) - 1));
+	}
+}
+
+/* Record that phase, which began at start (from trace_now()), ended now */
+void trace_phase(enum trace_phase phase, uint32_t conn_id, uint64_t start)
+{
+	trace_phase_end(phase, conn_id, start, trace_now());
+}
+
+/*
+ * Print the slowest connector's time of each phase and when the splash was
+ * scanned out, relative to the start of platsch and to boot. Callers wait for
+ * the page flips of their commits first, which end TRACE_MODESET.
+ */
+void trace_summary(void)
+{
+	uint64_t now = trace_now(), boot = clock_ns(CLOCK_BOOTTIME);
+	uint64_t shown;
+	char line[256];
+	int i, len = 0;
+
+	pthread_once(&trace_once, trace_open);
+
+	/* the kmsg priority prefix is skipped for stdout */
+	len += snprintf(line + len, sizeof(line) - len, "<6>platsch: ");
+	pthread_mutex_lock(&trace_lock);
+	for (i = 0; i < TRACE_PHASES; i++) {
+		if (!trace_end_time[i])
+			continue;
+		len += snprintf(line + len, sizeof(line) - len, "%s %llu.%01llu ms, ",
+				phase_names[i],
+				(unsigned long long)(trace_max[i] / NSEC_PER_MSEC),
+				(unsigned long long)(trace_max[i] % NSEC_PER_MSEC / 100000));
+		if (len >= sizeof(line))
+			break;
+	}
+	shown = trace_end_time[TRACE_PRESENT] ?: trace_end_time[TRACE_MODESET];
+	pthread_mutex_unlock(&trace_lock);
+
+	/* boot time of the scanout */
+	if (!shown)
+		shown = now;
+	if (len < sizeof(line))
+		snprintf(line + len, sizeof(line) - len,
+			 "shown after %llu ms, %llu ms after boot\n",
+			 (unsigned long long)((shown - trace_start) / NSEC_PER_MSEC),
+			 (unsigned long long)((boot - (now - shown)) / NSEC_PER_MSEC));
+
+	printf("%s", line + 3);
+	fflush(stdout);
+
+	if (kmsg_fd >= 0)
+		trace_write(kmsg_fd, line, strlen(line));
+}